@@ -1,16 +1,23 @@
-#ifndef RB_RF1A_H
-#define RB_RF1A_H
-
-void ResetRadioCore (void);
-unsigned char Strobe(unsigned char strobe);
-
-void WriteRfSettings(void);
-
-void WriteSingleReg(unsigned char addr, unsigned char value);
-void WriteBurstReg(unsigned char addr, unsigned char *buffer, unsigned char count);
-unsigned char ReadSingleReg(unsigned char addr);
-void ReadBurstReg(unsigned char addr, unsigned char *buffer, unsigned char count);
-void WriteSinglePATable(unsigned char value);
-void WriteBurstPATable(unsigned char *buffer, unsigned char count); 
-
-#endif
+#ifndef RB_RF1A_H
+#define RB_RF1A_H
+
+// Data rate profiles for WriteRfSettings()
+#define RF_PROFILE_1K2   0  // 1.2 kBaud GFSK, long range
+#define RF_PROFILE_38K4  1  // 38.4 kBaud GFSK, the default settings
+#define RF_PROFILE_250K  2  // 250 kBaud MSK, short range
+#define RF_PROFILES      3
+
+void ResetRadioCore (void);
+unsigned char Strobe(unsigned char strobe);
+
+void WriteRfSettings(unsigned char profile);
+void WriteRfSleepSettings(unsigned char profile);
+
+void WriteSingleReg(unsigned char addr, unsigned char value);
+void WriteBurstReg(unsigned char addr, unsigned char *buffer, unsigned char count);
+unsigned char ReadSingleReg(unsigned char addr);
+void ReadBurstReg(unsigned char addr, unsigned char *buffer, unsigned char count);
+void WriteSinglePATable(unsigned char value);
+void WriteBurstPATable(unsigned char *buffer, unsigned char count); 
+
+#endif
@@ -0,0 +1,149 @@
+/*
+ * Batching of sensor readings into radio packets
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "batch.h"
+#include "rf.h"
+
+// Readings waiting to be sent, back to back as they were added
+static unsigned char batch_buf[PAYLOAD_LEN];
+static uint8_t batch_bytes = 0;
+static uint8_t batch_count = 0;                // Readings in batch_buf
+static uint8_t batch_last = 0;                 // Length of the latest reading
+static uint16_t batch_age = 0;                 // Seconds since the oldest reading
+
+static uint8_t batch_max_count = 1;
+static uint16_t batch_deadline = 0;
+
+/*
+ * Send the readings together once there are count of them, or once the
+ * oldest one has waited for deadline_s seconds
+ */
+void batch_init(uint8_t count, uint16_t deadline_s)
+{
+  batch_max_count = count;
+  batch_deadline = deadline_s;
+  batch_bytes = 0;
+  batch_count = 0;
+  batch_age = 0;
+}
+
+
+
+/*
+ * Add a reading to the batch. Returns 0 if it doesn't fit, the batch
+ * must then be sent first.
+ */
+uint8_t batch_add(unsigned char *buf, uint8_t len)
+{
+  uint8_t i;
+
+  if (len > rf_max_payload() - batch_bytes) {
+    return 0;
+  }
+
+  for (i = 0; i < len; ++i) {
+    batch_buf[batch_bytes + i] = buf[i];
+  }
+  batch_bytes += len;
+  batch_last = len;
+  ++batch_count;
+
+  return 1;
+}
+
+
+
+/*
+ * Tell how many seconds have passed, e.g. after sleeping
+ */
+void batch_elapsed(uint16_t s)
+{
+  if (batch_count == 0) {
+    return;
+  }
+
+  if (batch_age > 0xFFFF - s) {
+    batch_age = 0xFFFF;
+  } else {
+    batch_age += s;
+  }
+}
+
+
+
+/*
+ * Return 1 if the batch should be sent now: it has enough readings, the
+ * oldest reading has waited long enough, or the next reading of the same
+ * size wouldn't fit
+ */
+uint8_t batch_due(void)
+{
+  if (batch_count == 0) {
+    return 0;
+  }
+
+  return batch_count >= batch_max_count ||
+    batch_age >= batch_deadline ||
+    batch_last > rf_max_payload() - batch_bytes;
+}
+
+
+
+/*
+ * Queue the batch to the radio as one message and start a new batch
+ */
+void batch_flush(void)
+{
+  if (batch_bytes > 0) {
+    rf_append_msg(batch_buf, batch_bytes);
+  }
+
+  batch_bytes = 0;
+  batch_count = 0;
+  batch_age = 0;
+}
+
+
+
+/*
+ * Check if the batch queued by batch_flush() got through, after waiting
+ * for the radio. lost is rf_tx_lost from before the flush. A batch still
+ * in the queue, waiting for a clear channel or an ACK, didn't.
+ */
+uint8_t batch_delivered(uint8_t lost)
+{
+  return rf_tx_lost == lost && RfTxQueueLength == 0;
+}
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,152 @@
+/*
+ * Clock system
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "clock.h"
+
+#include "hal_pmm.h"
+
+typedef struct clock_setting_t {
+  uint32_t hz;
+  uint16_t dcorsel;                            // DCO range for 2 x hz
+  uint16_t flln;                               // FLL multiplier - 1
+  uint8_t vcore;                               // Core voltage level needed
+} clock_setting_t;
+
+// DCOCLK runs at 2 x hz and MCLK and SMCLK use DCOCLKDIV (FLLD = 2)
+static const clock_setting_t clock_settings[] = {
+  [CLOCK_1MHZ]      = { CLOCK_DEFAULT_HZ,   DCORSEL_2, 31,  0 },
+  [CLOCK_8MHZ]      = { 7995392UL,          DCORSEL_5, 243, 0 },
+  [CLOCK_12MHZ]     = { 11993088UL,         DCORSEL_5, 365, 1 },
+  [CLOCK_20MHZ]     = { 19988480UL,         DCORSEL_7, 609, 3 },
+  [CLOCK_XT2_13MHZ] = { CLOCK_XT2_HZ / 2,   0,         0,   2 },
+};
+
+static uint32_t clock_current_hz = CLOCK_DEFAULT_HZ;
+
+static void clock_set_dco(const clock_setting_t *setting);
+static void clock_set_xt2(void);
+
+/*
+ * Run MCLK and SMCLK at the given speed. ACLK is left as it is, so the
+ * timers keep their timing. The default speed leaves the clock as it is
+ * after reset.
+ */
+void clock_init(enum CLOCK_SPEED speed)
+{
+  const clock_setting_t *setting = &clock_settings[speed];
+
+  if (speed == CLOCK_1MHZ) {
+    return;
+  }
+
+  // Raise the core voltage before the clock, never lower it here
+  if ((PMMCTL0 & PMMCOREV_3) < setting->vcore) {
+    SetVCore(setting->vcore);
+  }
+
+  if (speed == CLOCK_XT2_13MHZ) {
+    clock_set_xt2();
+  } else {
+    clock_set_dco(setting);
+  }
+
+  clock_current_hz = setting->hz;
+}
+
+
+
+/*
+ * Return the MCLK and SMCLK frequency in Hz
+ */
+uint32_t clock_hz(void)
+{
+  return clock_current_hz;
+}
+
+
+
+/*
+ * Lock the DCO to REFO with the FLL
+ */
+static void clock_set_dco(const clock_setting_t *setting)
+{
+  uint16_t i;
+
+  UCSCTL3 = SELREF__REFOCLK;                // FLL reference is REFO
+
+  __bis_status_register(SCG0);              // Disable the FLL control loop
+  UCSCTL0 = 0;                              // Lowest DCOx and MODx
+  UCSCTL1 = setting->dcorsel;               // DCO range
+  UCSCTL2 = FLLD_1 + setting->flln;         // (N + 1) x 32768 Hz = DCOCLKDIV
+  __bic_status_register(SCG0);              // Enable the FLL control loop
+
+  // Worst case settling time of the DCO after a range change is
+  // 32 x 32 x MCLK / FLL reference cycles, hz / 32 at the target speed
+  for (i = setting->hz / 32000; i > 0; --i) {
+    __delay_cycles(1000);
+  }
+
+  // Wait until the DCO fault flag stays cleared
+  do {
+    UCSCTL7 &= ~DCOFFG;
+    SFRIFG1 &= ~OFIFG;
+  } while (UCSCTL7 & DCOFFG);
+
+  UCSCTL5 = (UCSCTL5 & ~(DIVM_7 + DIVS_7)) + DIVM__1 + DIVS__1;
+  UCSCTL4 = (UCSCTL4 & ~(SELM_7 + SELS_7)) + SELM__DCOCLKDIV + SELS__DCOCLKDIV;
+}
+
+
+
+/*
+ * Run from the 26MHz radio crystal divided by two. The crystal is kept
+ * running even while the radio sleeps.
+ */
+static void clock_set_xt2(void)
+{
+  UCSCTL6 &= ~XT2OFF;                       // Crystal on
+
+  // Wait until the crystal has started
+  do {
+    UCSCTL7 &= ~XT2OFFG;
+    SFRIFG1 &= ~OFIFG;
+  } while (UCSCTL7 & XT2OFFG);
+
+  UCSCTL5 = (UCSCTL5 & ~(DIVM_7 + DIVS_7)) + DIVM__2 + DIVS__2;
+  UCSCTL4 = (UCSCTL4 & ~(SELM_7 + SELS_7)) + SELM__XT2CLK + SELS__XT2CLK;
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,54 @@
+/*
+ * Clock system
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef RB_CLOCK_H
+#define RB_CLOCK_H
+
+#include "common.h"
+
+#include <msp430.h>
+#include <stdint.h>
+
+#define CLOCK_DEFAULT_HZ   1048576UL           // DCO after reset, 32 x REFO
+#define CLOCK_XT2_HZ       26000000UL          // Radio crystal
+
+// MCLK and SMCLK speeds. Faster clocks need a higher core voltage, which
+// clock_init() sets, and a sensor that lowers it to save power must stay
+// at CLOCK_1MHZ.
+enum CLOCK_SPEED {
+  CLOCK_1MHZ = 0,                              // The default DCO
+  CLOCK_8MHZ,                                  // DCO locked to REFO
+  CLOCK_12MHZ,                                 // DCO locked to REFO
+  CLOCK_20MHZ,                                 // DCO locked to REFO
+  CLOCK_XT2_13MHZ,                             // Radio crystal / 2
+};
+
+void clock_init(enum CLOCK_SPEED speed);
+uint32_t clock_hz(void);
+
+#endif
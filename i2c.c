@@ -27,6 +27,7 @@
  */
 
 #include "i2c.h"
+#include "clock.h"
 
 #define RB_I2C_MAX_RX_BYTES  8
 
@@ -102,7 +103,7 @@ void i2c_init(void)
   UCB0CTL1 |= UCSWRST;                      // Enable SW reset
   UCB0CTL0 = UCMST + UCMODE_3 + UCSYNC;     // I2C Master, synchronous mode
   UCB0CTL1 = UCSSEL_2 + UCSWRST;            // Use SMCLK, keep SW reset
-  UCB0BR0 = 12;                             // fSCL = SMCLK/12 = ~100kHz
+  UCB0BR0 = 12 * (clock_hz() / CLOCK_DEFAULT_HZ); // fSCL = ~90kHz at any clock
   UCB0BR1 = 0;
   // FIXME: shouldn't set slave address here? At least a parameter
   UCB0I2CSA = 0x4F;                         // TMP275 Slave Address is 04Fh
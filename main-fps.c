@@ -88,7 +88,7 @@ int main(void)
   P2DIR &= ~BIT3;
 
   led_init();
-  uart_init();
+  uart_init(UART_BAUD);
 
   #if SC_USE_SLEEP == 0
   // Enable interrupts
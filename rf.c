@@ -27,28 +27,276 @@
  */
 
 #include "rf.h"
-#include "uart.h"
 #include "led.h"
 #include "utils.h"
 #include "timer.h"
 
-// Buffer for incoming data from RF
-volatile unsigned char RfRxBuffer[PACKET_LEN];
-volatile unsigned char RfRxBufferLength = 0;
+// Set to 1 to drive debug led 2 high for the duration of CC1101_ISR, so
+// that the interrupt handler cost can be measured with a scope
+#ifndef RF_MEASURE_ISR
+#define RF_MEASURE_ISR     0
+#endif
+
+// Carrier sense threshold for the clear channel assessment, in dB
+// relative to MAGN_TARGET (-8..7, AGCCTRL1.CARRIER_SENSE_ABS_THR)
+#ifndef RF_CCA_ABS_THR
+#define RF_CCA_ABS_THR     0
+#endif
+
+// How long to wait for the radio to leave RX after a CCA gated STX. The
+// radio stays in RX for the RX to TX turnaround even when the channel
+// was clear, so only a radio still in RX after this means CCA failed.
+#ifndef RF_STX_TIMEOUT_US
+#define RF_STX_TIMEOUT_US  (250)
+#endif
+
+// Keep the frequency synthesizer calibration of each channel and write
+// it back when changing channels, instead of calibrating on every IDLE to
+// RX/TX transition (MCSM0.FS_AUTOCAL)
+#ifndef RF_USE_FSCAL_CACHE
+#define RF_USE_FSCAL_CACHE 1
+#endif
 
-// Queue for messages to be sent out over RF
+// Wake on radio settings. The radio sniffs for RX_TIME (3.6% of the WOR
+// interval) and stops early if there's no carrier (RX_TIME_RSSI). It
+// stays in RX if a preamble was detected (RX_TIME_QUAL, PQT).
+#define RF_WOR_MCSM2       (0x18)              // RX_TIME_RSSI, RX_TIME_QUAL, RX_TIME = 0
+#define RF_WOR_WORCTRL     (0x78)              // RC oscillator on, EVENT1 = 7, RC_CAL, WOR_RES = 0
+#define RF_WOR_PQT         (3 << 5)            // Preamble quality threshold, PKTCTRL1.PQT
+
+// PKTSTATUS bits
+#define RF_PKTSTATUS_CCA   (BIT4)              // Channel is clear
+#define RF_PKTSTATUS_SFD   (BIT3)              // Sync word found, receiving a packet
+#define RF_MARCSTATE_MASK  (0x1F)              // Main radio control state
+#define RF_MARCSTATE_RX    (0x0D)
+#define RF_MARCSTATE_TX    (0x13)
+#define RF_PKTCTRL1_ADR_CHK (0x02)             // Check the address, 0x00 is broadcast
+#define RF_MCSM0_FS_AUTOCAL (0x30)             // When to calibrate the synthesizer
+#define RF_MCSM0_FS_AUTOCAL_IDLE (0x10)        // From IDLE to RX or TX
+#define RF_MDMCFG1_FEC_EN  (0x80)              // Convolutional FEC with interleaving
+#define RF_PKTCTRL0_LENGTH_CONFIG (0x03)       // 00 fixed, 01 variable packet length
+#define RF_RX_ACK_SIZE     (RF_FEC_PKTLEN + 2 > RF_HDR_LEN + RF_ACK_LEN + 3 ? \
+                            RF_FEC_PKTLEN + 2 : RF_HDR_LEN + RF_ACK_LEN + 3)
+#define RF_FSCAL_CACHE     (RF_CHANNELS < 8 ? RF_CHANNELS : 8) // Channels with a calibration kept
+#define RF_FSCAL_NO_TEMP   (-128)              // No temperature given yet
+#define RF_TX_PACKETS      (16)                // Messages queued with rf_append_packet_to()
+
+// Fields of the link header
+#define RF_HDR_DST         (0)
+#define RF_HDR_SRC         (1)
+#define RF_HDR_FLAGS       (2)
+#define RF_HDR_SEQ         (3)
+
+// Marks an unused entry in the slot tables
+#define RF_RX_NO_SLOT      (0xFF)
+
+// Queue of packets received over RF. Each slot holds a whole packet:
+// len dst src flags seq <payload> RSSI CRC/LQI
+// Window transfers can fill the slots out of order, so the packets are
+// handed to the main loop through a queue of slot numbers.
+static volatile unsigned char RfRxQueue[RF_RX_QUEUE_SLOTS][PACKET_LEN];
+static volatile uint8_t RfRxQueue_slots[RF_RX_QUEUE_SLOTS]; // Slots in arrival order
+static volatile uint8_t RfRxQueue_head = 0;     // Index of the oldest packet in RfRxQueue_slots
+static volatile uint8_t RfRxQueueLength = 0;    // Amount of received packets
+static volatile uint8_t RfRxQueue_free = 0;     // Bit mask of the unused slots
+
+// Circular queue for messages to be sent out over RF
 volatile unsigned char RfTxQueue[RF_QUEUE_LEN];
-volatile unsigned char RfTxQueue_i = 0;
+volatile uint16_t RfTxQueue_head = 0;
+volatile uint16_t RfTxQueue_tail = 0;
+volatile uint16_t RfTxQueueLength = 0;
 
-// Buffer for outgoing data over RF
-volatile unsigned char RfTxBuffer[PACKET_LEN];
 volatile unsigned char rf_error = 0;
 
 volatile unsigned char rf_transmitting = 0;
 volatile unsigned char rf_receiving = 0;
-
-static void transmit_msg(unsigned char *buffer, unsigned char length);
+volatile unsigned char rf_arq_waiting = 0;
+volatile unsigned char rf_backoff = 0;
+volatile unsigned char rf_tx_lost = 0;
+
+// State of the packet currently being streamed into the TX FIFO
+static volatile uint16_t rf_tx_pos = 0;       // Queue index of the next byte for the FIFO
+static volatile unsigned char rf_tx_left = 0; // Bytes not yet written to the FIFO
+static volatile unsigned char rf_tx_pad = 0;  // Padding after them, in the FEC mode
+static volatile unsigned char rf_tx_flags = 0;// Link header flags of the packet
+
+// Node addresses. With an address set the radio drops packets to other
+// nodes (PKTCTRL1.ADR_CHK) before they reach the RX FIFO.
+static unsigned char rf_address = 0;           // ADDR, 0 for no address check
+static volatile unsigned char rf_tx_dst = RF_ADDR_GATEWAY; // Destination of the queued messages
+static volatile unsigned char rf_tx_relay = 0; // Queue holds one relayed packet
+
+// Lengths of the messages queued with rf_append_packet_to(), oldest
+// first. While there are any, the queue holds only such messages and
+// each goes out as a packet of its own.
+static volatile unsigned char rf_tx_pkt_len[RF_TX_PACKETS];
+static volatile uint8_t rf_tx_pkt_first = 0;
+static volatile uint8_t rf_tx_pkt_count = 0;
+
+// Window of messages sent from the head of RfTxQueue. The messages are
+// kept in the queue until sent or, with ARQ, until acknowledged.
+static volatile unsigned char rf_win_len[RF_ARQ_MAX_WINDOW];   // Payload lengths
+static volatile unsigned char rf_win_tries[RF_ARQ_MAX_WINDOW]; // Times sent
+static volatile uint8_t rf_win_count = 0;      // Messages in the window
+static volatile uint8_t rf_win_acked = 0;      // Bit mask of acknowledged messages
+static volatile uint8_t rf_win_burst = 0;      // Bit mask of messages still to send in this burst
+
+// State of the packet currently being received
+static volatile unsigned char *rf_rx_slot = 0; // Buffer for the packet, 0 to discard it
+static volatile uint8_t rf_rx_slot_no = RF_RX_NO_SLOT; // Queue slot of the buffer
+static volatile uint16_t rf_rx_size = 0;       // Size of the buffer
+static volatile uint16_t rf_rx_len = 0;        // Bytes received so far
+
+// Buffer for receiving ACKs when the RX queue is full, big enough for a
+// padded ACK of the FEC mode
+static volatile unsigned char rf_rx_ack[RF_RX_ACK_SIZE];
+
+// Acknowledged transfer state. Sequence numbers survive rf_init() so that
+// a receiver doesn't mistake the first frame after a reset for a duplicate.
+static unsigned char rf_arq_window = 0;        // Frames in flight, 0 for no ARQ
+static unsigned char rf_tx_seq = 0;            // Sequence number of the first frame in the window
+
+// Last acknowledged frame received from each sender, to drop the
+// retransmissions after a lost ACK, and the TX power level used towards
+// it. Replaced round robin. For a sender
+// of window transfers with its bit in rf_rx_peer_win, the sequence number
+// is the next one expected when it was interrupted by another sender.
+static volatile unsigned char rf_rx_peer_addr[RF_RX_PEERS];
+static volatile unsigned char rf_rx_peer_seq[RF_RX_PEERS];
+static volatile unsigned char rf_rx_peer_len[RF_RX_PEERS];
+static volatile uint8_t rf_rx_peer_power[RF_RX_PEERS];
+static volatile uint8_t rf_rx_peer_win = 0;    // One bit per peer
+static volatile uint8_t rf_rx_peer_next = 0;
+
+// Wake on radio state. The radio loses the test registers and PATABLE
+// while it sleeps between the WOR wake ups.
+static volatile unsigned char rf_wor_active = 0; // Radio in WOR, settings changed
+static unsigned char rf_wor_mcsm2;             // MCSM2 and PKTCTRL1 before WOR
+static unsigned char rf_wor_pktctrl1;
+static unsigned char rf_use_long_preamble = 0;
+
+// FEC mode. The radio only does FEC with fixed length packets, so all
+// packets are padded to RF_FEC_PKTLEN. The length byte is sent after the
+// link header, to keep the destination first for the address check:
+// dst src flags seq len <payload> <padding>
+static unsigned char rf_use_fec = 0;
+static volatile unsigned char rf_preamble = 0;   // Sending the long preamble
+
+// Marks that no data rate change is requested
+#define RF_NO_PROFILE      (0xFF)
+
+// Data rate adaptation state. The sender asks the receiver to change the
+// profile, and both switch once the request has been acknowledged. After
+// RF_RATE_LEASE_MS without traffic both fall back to RF_RATE_BASE_PROFILE,
+// so a lost ACK or a failed link can't leave them on different profiles.
+static unsigned char rf_profile = RF_PROFILE_38K4;
+static unsigned char rf_use_rate_adapt = 0;
+static volatile unsigned char rf_rate_req = RF_NO_PROFILE; // Profile asked from the receiver
+static volatile uint8_t rf_rate_good = 0;      // ACKs in a row with margin to step up
+static volatile unsigned char rf_profile_next = RF_NO_PROFILE; // Switch agreed in the interrupt handler
+
+// Sensitivity of each profile in dBm, and ACK timeouts scaled by airtime
+static const int8_t rf_profile_sensitivity[RF_PROFILES] = { -112, -104, -95 };
+static const uint16_t rf_ack_timeout[RF_PROFILES] = {
+  RF_ARQ_ACK_TIMEOUT_MS * 16, RF_ARQ_ACK_TIMEOUT_MS, RF_ARQ_ACK_TIMEOUT_MS
+};
+
+// Time in RX before the RSSI, and so CCA, is valid. The narrower RX
+// filter of the slower profiles settles slower. Estimates, not measured.
+static const uint16_t rf_rssi_valid_us[RF_PROFILES] = { 1000, 300, 100 };
+
+// TX power control state. The ACKs report the RSSI of our messages at the
+// receiver, and the power towards that node (rf_rx_peer_power) is stepped
+// down the ladder as long as the margin stays above RF_TX_POWER_MARGIN_DB.
+// A missing ACK steps it up. The levels survive rf_wake(), so a sensor
+// keeps its level between rounds. rf_tx_power is the level in PATABLE.
+static unsigned char rf_use_tx_power_control = 0;
+static volatile uint8_t rf_tx_power = RF_TX_POWER_LEVELS - 1;
+
+// PATABLE values and output power in dBm of the power levels, 433 MHz
+static const unsigned char rf_tx_power_patable[RF_TX_POWER_LEVELS] = {
+  0x12, 0x05, 0x26, 0x51, PATABLE_VAL
+};
+static const int8_t rf_tx_power_dbm[RF_TX_POWER_LEVELS] = { -30, -12, -6, 0, 10 };
+
+// Frequency hopping state. All nodes share the pseudo-random hop
+// sequence. The master listens on each channel for RF_HOP_DWELL_MS. A
+// sender tries the next channel of the sequence after each missing ACK,
+// so a follower finds the master again within RF_CHANNELS tries and
+// then stays on the channel the ACK came from.
+static enum RF_HOP_MODE rf_hop_mode = RF_HOP_OFF;
+static unsigned char rf_hop_table[RF_CHANNELS];
+static volatile uint8_t rf_hop_index = 0;      // Place in the hop sequence to listen at
+static volatile uint8_t rf_hop_scan = 0;       // Channels tried ahead of it while sending
+static unsigned char rf_channel = 0;           // CHANNR
+
+// Synthesizer calibration cache. rf_fscal_loaded is the entry whose
+// values are in FSCAL3..1, RF_RX_NO_SLOT when the registers don't match
+// the channel. All entries are dropped after RF_FSCAL_MAX_AGE uses or a
+// temperature change of RF_FSCAL_TEMP_DELTA. rf_fscal_pending is set
+// while the radio calibrates on its own, until the main loop keeps the
+// result.
+static unsigned char rf_fscal_chan[RF_FSCAL_CACHE];
+static unsigned char rf_fscal_val[RF_FSCAL_CACHE][3]; // FSCAL3, FSCAL2, FSCAL1
+static uint8_t rf_fscal_valid = 0;             // Bit mask of the entries in use
+static uint8_t rf_fscal_next = 0;              // Entry to replace next
+static volatile uint8_t rf_fscal_loaded = RF_RX_NO_SLOT;
+static uint16_t rf_fscal_age = 0;
+static int8_t rf_fscal_temp = RF_FSCAL_NO_TEMP; // Temperature of the calibrations
+static volatile uint8_t rf_fscal_pending = 0;
+
+// Listen before talk state
+static unsigned char rf_use_csma = 0;
+static unsigned char rf_csma_be = RF_CSMA_MIN_BE; // Backoff exponent
+static volatile uint8_t rf_rssi_settling = 0;  // RX started, RSSI not checked valid yet
+static uint16_t rf_rand_state = 0xACE1;
+
+// Window transfer receive state. rf_rx_hold has the slots of frames
+// received ahead of rf_rx_next_seq, waiting for the missing ones.
+static volatile unsigned char rf_rx_next_seq = 0;
+static volatile unsigned char rf_rx_win_src = 0; // Sender of the window transfer
+static volatile uint8_t rf_rx_hold[RF_ARQ_MAX_WINDOW - 1];
+
+static void transmit_msg(unsigned char *header, unsigned char header_len,
+                         uint16_t pos, unsigned char length);
+static void transmit_window_msg(void);
+static void start_receive(unsigned char strobe);
+static void reset_state(void);
+static void write_rf_settings(void);
+static void leave_wor(void);
+static uint8_t channel_clear(void);
+static uint8_t packet_payload(void);
+static uint8_t tx_started(void);
+static void start_backoff(void);
+static uint16_t rf_rand(void);
+static unsigned char next_msg_len(uint16_t offset, enum RF_SEND_MSG force);
+static void send_ack(unsigned char flags, unsigned char seq);
+static void handle_ack(unsigned char flags, unsigned char seq,
+                       unsigned char map, unsigned char rssi, unsigned char lqi);
+static void adapt_rate(int16_t dbm, unsigned char lqi);
+static void adapt_tx_power(uint8_t peer, int16_t dbm);
+static void set_tx_power(uint8_t level);
+static uint8_t peer_tx_power(unsigned char addr);
+static void reset_tx_power(void);
+static void switch_profile(unsigned char profile);
+static void tune_hop_channel(void);
+static void calibrate(void);
+static void start_rate_lease(void);
+static void check_rate_lease(void);
+static void apply_profile(void);
+static void keep_calibration(void);
+static void poll_radio(void);
+static void release_window(uint8_t count);
+static void receive_window_msg(unsigned char seq);
+static void advance_rx_window(void);
+static void release_rx_hold(void);
+static void deliver_rx_slot(uint8_t slot);
+static void write_tx_fifo(unsigned char max_len);
+static void read_rx_fifo(unsigned char keep);
 static void handle_rf_rx_packet(void);
+static uint8_t rx_peer(unsigned char src);
+static uint8_t find_peer(unsigned char src);
+static uint16_t queue_index(uint16_t i);
 
 /*
  * Initialize CC1101 radio inside the CC430.
@@ -66,15 +314,76 @@ void rf_init(void)
   Strobe(RF_SRES);                          // Reset the Radio Core
   Strobe(RF_SNOP);                          // Reset Radio Pointer
 
-  RfRxBufferLength = 0;
-  RfTxQueue_i = 0;
+  reset_state();
+  rf_tx_power = RF_TX_POWER_LEVELS - 1;
+  rf_fscal_valid = 0;
+  write_rf_settings();
+}
+
+
+
+/*
+ * Wake up the radio after rf_shutdown() without resetting it. The radio
+ * keeps its configuration in SLEEP, except for the test registers and
+ * PATABLE, so only those are written again.
+ */
+void rf_wake(void)
+{
+  unsigned char wor = rf_wor_active;
+
+  // Any strobe wakes up the radio, Strobe() waits until it's ready
+  Strobe(RF_SIDLE);
+
+  reset_state();
+
+  if (wor) {
+    // WOR settings were left in place
+    write_rf_settings();
+  } else {
+    WriteRfSleepSettings(rf_profile);
+    WriteSinglePATable(rf_tx_power_patable[rf_tx_power]);
+  }
+}
+
+
+
+/*
+ * Reset the queues and the state of the radio driver
+ */
+static void reset_state(void)
+{
+  uint8_t i;
+
+  RfRxQueue_head = 0;
+  RfRxQueueLength = 0;
+  RfRxQueue_free = (1 << RF_RX_QUEUE_SLOTS) - 1;
+  for (i = 0; i < RF_ARQ_MAX_WINDOW - 1; ++i) {
+    rf_rx_hold[i] = RF_RX_NO_SLOT;
+  }
+  rf_rx_len = 0;
+  RfTxQueue_head = 0;
+  RfTxQueue_tail = 0;
+  RfTxQueueLength = 0;
+  rf_tx_pkt_first = 0;
+  rf_tx_pkt_count = 0;
+  rf_tx_left = 0;
+  rf_tx_pad = 0;
+  rf_win_count = 0;
+  rf_win_acked = 0;
+  rf_win_burst = 0;
   rf_error = 0;
   rf_transmitting = 0;
   rf_receiving = 0;
-
-  WriteRfSettings();
-
-  WriteSinglePATable(PATABLE_VAL);
+  rf_arq_waiting = 0;
+  rf_backoff = 0;
+  rf_csma_be = RF_CSMA_MIN_BE;
+  rf_preamble = 0;
+  rf_wor_active = 0;
+  rf_rate_req = RF_NO_PROFILE;
+  rf_rate_good = 0;
+  rf_profile_next = RF_NO_PROFILE;
+  timer_timeout_clear();
+  timer_lease_clear();
 }
 
 
@@ -108,19 +417,86 @@ void rf_shutdown(void)
  */
 void rf_receive_on(void)
 {
+  start_receive(RF_SRX);
+}
+
+
+
+/*
+ * Turn on RF receiver in Wake on Radio mode. The radio sleeps and wakes
+ * up every RF_WOR_INTERVAL_MS to listen for a preamble, so the sender
+ * must use a long preamble. The MCU can sleep in LPM3 until a packet
+ * has been received. The radio must be idle.
+ */
+void rf_receive_wor(void)
+{
+  // Set the High-Power Mode Request Enable bit so LPM3 can be entered
+  // with active radio enabled
+  PMMCTL0_H = 0xA5;
+  PMMCTL0_L |= PMMHPMRE_L;
+  PMMCTL0_H = 0x00;
+
+  rf_wor_mcsm2 = ReadSingleReg(MCSM2);
+  rf_wor_pktctrl1 = ReadSingleReg(PKTCTRL1);
+  WriteSingleReg(MCSM2, RF_WOR_MCSM2);
+  WriteSingleReg(PKTCTRL1, (rf_wor_pktctrl1 & 0x1F) | RF_WOR_PQT);
+  WriteSingleReg(WOREVT1, RF_WOR_EVENT0 >> 8);
+  WriteSingleReg(WOREVT0, RF_WOR_EVENT0 & 0xFF);
+  WriteSingleReg(WORCTRL, RF_WOR_WORCTRL);
+  rf_wor_active = 1;
+
+  start_receive(RF_SWOR);
+}
+
+
+
+/*
+ * Prepare for receiving a packet and start the receiver with the given
+ * strobe
+ */
+static void start_receive(unsigned char strobe)
+{
+  uint8_t slot;
+
+  tune_hop_channel();
+  calibrate();
+
   rf_receiving = 1;
+  rf_rssi_settling = 1;
+
+  // Receive into the first free slot. If the main loop hasn't yet
+  // consumed the earlier packets, only an ACK can be received.
+  rf_rx_len = 0;
+  for (slot = 0; slot < RF_RX_QUEUE_SLOTS; ++slot) {
+    if (RfRxQueue_free & (1 << slot)) {
+      break;
+    }
+  }
+
+  if (slot < RF_RX_QUEUE_SLOTS) {
+    rf_rx_slot = RfRxQueue[slot];
+    rf_rx_slot_no = slot;
+    rf_rx_size = PACKET_LEN;
+  } else {
+    rf_rx_slot = rf_rx_ack;
+    rf_rx_slot_no = RF_RX_NO_SLOT;
+    rf_rx_size = sizeof(rf_rx_ack);
+  }
 
-  // Falling edge of RFIFG9
+  // Falling edge of RFIFG9 (end of packet), rising edge of RFIFG0 (RX
+  // FIFO filled above the threshold)
   RF1AIES |= BIT9;
+  RF1AIES &= ~BIT0;
 
   // Clear a pending interrupt
-  RF1AIFG &= ~BIT9;
+  RF1AIFG &= ~(BIT9 | BIT0);
 
   // Enable the interrupt
-  RF1AIE  |= BIT9;
+  RF1AIE  |= BIT9 | BIT0;
 
-  // Radio is in IDLE following a TX, so strobe SRX to enter Receive Mode
-  Strobe(RF_SRX);
+  // Radio is in IDLE following a TX, so strobe SRX (or SWOR) to enter
+  // Receive Mode
+  Strobe(strobe);
 }
 
 
@@ -132,10 +508,10 @@ void rf_receive_off(void)
 {
 
   // Disable RX interrupts
-  RF1AIE &= ~BIT9;
+  RF1AIE &= ~(BIT9 | BIT0);
 
   // Clear pending IFG
-  RF1AIFG &= ~BIT9;
+  RF1AIFG &= ~(BIT9 | BIT0);
 
   // It is possible that ReceiveOff is called while radio is receiving a packet.
   // Therefore, it is necessary to flush the RX FIFO after issuing IDLE strobe
@@ -143,22 +519,98 @@ void rf_receive_off(void)
   Strobe(RF_SIDLE);
   Strobe(RF_SFRX);
 
+  if (rf_wor_active) {
+    leave_wor();
+  }
+
   rf_receiving = 0;
 }
 
 
 
 /*
- * RF TX or RX ready (one whole message)
+ * Write the radio settings used by this module
+ */
+static void write_rf_settings(void)
+{
+  WriteRfSettings(rf_profile);
+
+  // Carrier sense threshold for CCA (MCSM1.CCA_MODE)
+  WriteSingleReg(AGCCTRL1, (ReadSingleReg(AGCCTRL1) & 0xF0) | (RF_CCA_ABS_THR & 0x0F));
+
+  WriteSingleReg(CHANNR, rf_channel);
+
+#if RF_USE_FSCAL_CACHE == 1
+  // Calibrate only when the channel changes, see calibrate(). The
+  // settings have the default calibration, so put back the real one.
+  WriteSingleReg(MCSM0, ReadSingleReg(MCSM0) & ~RF_MCSM0_FS_AUTOCAL);
+  rf_fscal_loaded = RF_RX_NO_SLOT;
+  rf_fscal_pending = 0;
+  calibrate();
+#endif
+
+  if (rf_address != 0) {
+    WriteSingleReg(ADDR, rf_address);
+    WriteSingleReg(PKTCTRL1, ReadSingleReg(PKTCTRL1) | RF_PKTCTRL1_ADR_CHK);
+  }
+
+  if (rf_use_fec) {
+    WriteSingleReg(MDMCFG1, ReadSingleReg(MDMCFG1) | RF_MDMCFG1_FEC_EN);
+    WriteSingleReg(PKTCTRL0, ReadSingleReg(PKTCTRL0) & ~RF_PKTCTRL0_LENGTH_CONFIG);
+    WriteSingleReg(PKTLEN, RF_FEC_PKTLEN);
+  }
+
+  WriteSinglePATable(rf_tx_power_patable[rf_tx_power]);
+}
+
+
+
+/*
+ * Restore the settings changed for WOR, and the ones lost during the WOR
+ * sleep, once the radio is idle again. Called from the interrupt handler
+ * before the ACK, so only those few registers are written.
+ */
+static void leave_wor(void)
+{
+  WriteSingleReg(MCSM2, rf_wor_mcsm2);
+  WriteSingleReg(PKTCTRL1, rf_wor_pktctrl1);
+  WriteRfSleepSettings(rf_profile);
+  WriteSinglePATable(rf_tx_power_patable[rf_tx_power]);
+  rf_wor_active = 0;
+}
+
+
+
+/*
+ * RF TX or RX ready (one whole message), or FIFO crossed its threshold
  */
 __attribute__((interrupt(CC1101_VECTOR)))
 void CC1101_ISR(void)
 {
+  unsigned char wake = 1;
+
+#if RF_MEASURE_ISR == 1
+  led_on(2);
+#endif
+
   switch(RF1AIV) {                          // Prioritizing Radio Core Interrupt
   case  0: break;                           // No RF core interrupt pending
-  case  2: break;                           // RFIFG0
+  case  2:                                  // RFIFG0
+
+    // RX FIFO above threshold, drain it but leave the last byte until
+    // the end of packet
+    if (rf_receiving) {
+      read_rx_fifo(1);
+    }
+    break;
   case  4: break;                           // RFIFG1
-  case  6: break;                           // RFIFG2
+  case  6:                                  // RFIFG2
+
+    // TX FIFO drained below threshold, refill it
+    if (rf_transmitting) {
+      write_tx_fifo(RF_FIFO_LEN - RF_TX_FIFO_THR);
+    }
+    break;
   case  8: break;                           // RFIFG3
   case 10: break;                           // RFIFG4
   case 12: break;                           // RFIFG5
@@ -167,17 +619,57 @@ void CC1101_ISR(void)
   case 18: break;                           // RFIFG8
   case 20:                                  // RFIFG9
 
-    // Disable RFIFG9 interrupts
-    RF1AIE &= ~BIT9;
+    // Packet to another node. The radio dropped it and went on
+    // listening, so let the MCU sleep on.
+    if (rf_receiving && rf_rx_len == 0 && !rf_wor_active &&
+        (Strobe(RF_SNOP) & CC430_STATE_MASK) == CC430_STATE_RX &&
+        ReadSingleReg(RXBYTES) == 0) {
+      wake = 0;
+      break;
+    }
+
+    // Disable RFIFG9 and FIFO threshold interrupts
+    RF1AIE &= ~(BIT9 | BIT2 | BIT0);
+
+    // Woke up to receive a packet, the radio is now idle
+    if (rf_wor_active) {
+      leave_wor();
+    }
 
-    // RX end of packet
     if(rf_receiving) {
+      // RX end of packet
       handle_rf_rx_packet();
+    } else if(rf_transmitting) {
+      // RF TX end of packet
+      rf_transmitting = 0;
+
+      if (rf_tx_flags & RF_FLAG_ACK) {
+        // ACK sent, nothing to release. Change the data rate from the
+        // main loop, if the sender asked for it.
+        if (rf_tx_flags & RF_FLAG_RATE) {
+          rf_profile_next = rf_tx_flags & RF_FLAG_PROFILE;
+        }
+      } else if (rf_win_burst) {
+        // Send the next message of the burst right away
+        transmit_window_msg();
+      } else if (rf_tx_flags & RF_FLAG_ACK_REQ) {
+        // Keep the messages in the queue and listen for the ACK
+        rf_arq_waiting = 1;
+        if (rf_use_fec) {
+          // Twice the symbols, and the ACK is padded
+          timer_timeout_set(rf_ack_timeout[rf_profile] * 2);
+        } else {
+          timer_timeout_set(rf_ack_timeout[rf_profile]);
+        }
+      } else {
+        // Release the sent bytes from the queue
+        release_window(rf_win_count);
+      }
     }
 
-    // RF TX end of packet
-    if(rf_transmitting) {
-      rf_transmitting = 0;
+    // Keep listening while waiting for an ACK
+    if (rf_arq_waiting && !rf_transmitting && !rf_receiving) {
+      rf_receive_on();
     }
     break;
     // FIXME: RFIFG10 == RX with valid CRC?
@@ -189,241 +681,1828 @@ void CC1101_ISR(void)
   case 32: break;                           // RFIFG15
   }
 
+#if RF_MEASURE_ISR == 1
+  led_off(2);
+#endif
+
 #if SC_USE_SLEEP == 1
-  __bic_status_register_on_exit(LPM0_bits); // Exit active
+  // Exit active, the MCU sleeps in LPM3 in WOR mode
+  if (wake) {
+    __bic_status_register_on_exit(LPM3_bits);
+  }
 #endif
 }
 
 
 
 /*
- * Append new message to transmit queue
+ * Append new message to transmit queue. Returns 0 if the message was
+ * discarded because the queue is full.
  */
-void rf_append_msg(unsigned char *buf, unsigned char len)
+uint8_t rf_append_msg(unsigned char *buf, uint16_t len)
 {
-  unsigned char i;
+  uint16_t i;
+  uint16_t first;
 
   // Disable interrupts to make sure RfTxQueue isn't modified in the middle
   __bic_status_register(GIE);
 
   // Discard msg if no space in the queue
-  if ((RfTxQueue_i + len) > RF_QUEUE_LEN) {
+  if (len > RF_QUEUE_LEN - RfTxQueueLength) {
     // Enable interrupts
     __bis_status_register(GIE);
-    return;
+    return 0;
   }
 
-  for (i = 0; i < len; ++i) {
-    RfTxQueue[RfTxQueue_i + i] = buf[i];
+  // Copy up to the end of the queue, then wrap around to the beginning
+  first = RF_QUEUE_LEN - RfTxQueue_tail;
+  if (first > len) {
+    first = len;
   }
 
-  RfTxQueue_i += len;
+  for (i = 0; i < first; ++i) {
+    RfTxQueue[RfTxQueue_tail + i] = buf[i];
+  }
+  for (; i < len; ++i) {
+    RfTxQueue[i - first] = buf[i];
+  }
+
+  RfTxQueue_tail = queue_index(RfTxQueue_tail + len);
+  RfTxQueueLength += len;
 
   // Enable interrupts
   __bis_status_register(GIE);
+
+  return 1;
 }
 
 
 
 /*
- * Send next message from the queue
+ * Send the messages of the window that haven't been acknowledged and new
+ * messages from the queue, up to the window size, back to back. Only the
+ * last message of the burst requests an ACK. With CSMA enabled the burst
+ * is started only if the channel is clear. Returns the amount of new
+ * messages taken from the queue.
  */
 uint8_t rf_send_next_msg(enum RF_SEND_MSG force)
 {
-  unsigned char x;
-  int len = -1;
+  unsigned char len;
+  uint16_t offset = 0;
+  uint8_t window;
+  uint8_t sent = 0;
+  uint8_t i;
 
   // Do nothing, if already transmitting
   if (rf_transmitting) {
+
+    // Long preamble sent, write the first message after it
+    if (rf_preamble && timer_timeout_occurred) {
+      __bic_status_register(GIE);
+      timer_timeout_clear();
+      rf_preamble = 0;
+      transmit_window_msg();
+      __bis_status_register(GIE);
+    }
     return 0;
   }
 
   // Disable interrupts to make sure RfTxQueue isn't modified in the middle
   __bic_status_register(GIE);
 
-  if (force) {
-    len = RfTxQueue_i;
-  } else {
-    // Find the end of the first message
-    for (x = 0; x < RfTxQueue_i; x++) {
-      if (RfTxQueue[x] == '\n') {
-        len = x + 1;
-        break;
+  poll_radio();
+
+  if (rf_arq_waiting) {
+    // Keep waiting for the ACK of the previous burst
+    if (!timer_timeout_occurred) {
+      // Enable interrupts
+      __bis_status_register(GIE);
+      return 0;
+    }
+
+    // No ACK in time, send the messages again with more power
+    timer_timeout_clear();
+    rf_arq_waiting = 0;
+    if (rf_use_tx_power_control) {
+      i = find_peer(rf_tx_dst);
+      if (i < RF_RX_PEERS && rf_rx_peer_power[i] < RF_TX_POWER_LEVELS - 1) {
+        ++rf_rx_peer_power[i];
       }
     }
 
-    // No newline, do nothing
-    if (len == -1) {
+    // The master may have moved on, try the next channel of the sequence
+    if (rf_hop_mode != RF_HOP_OFF) {
+      rf_hop_scan = (rf_hop_scan + 1) % RF_CHANNELS;
+    }
+  }
+
+  if (rf_backoff) {
+    // Channel was busy, wait for the backoff to end
+    if (!timer_timeout_occurred) {
       // Enable interrupts
       __bis_status_register(GIE);
       return 0;
     }
+
+    timer_timeout_clear();
+    rf_backoff = 0;
+  }
+
+  // Give up the whole window, if a message has been sent too many
+  // times. Skip the sequence numbers of a window so that a window
+  // receiver starts over instead of waiting for the missing message.
+  for (i = 0; i < rf_win_count; ++i) {
+    if (!(rf_win_acked & (1 << i)) && rf_win_tries[i] > RF_ARQ_MAX_RETRIES) {
+      release_window(rf_win_count);
+      rf_win_acked = 0;
+      rf_tx_seq += RF_ARQ_MAX_WINDOW;
+      ++rf_tx_lost;
+
+      // Link lost, start over from full power
+      if (rf_use_tx_power_control) {
+        uint8_t peer = find_peer(rf_tx_dst);
+
+        if (peer < RF_RX_PEERS) {
+          rf_rx_peer_power[peer] = RF_TX_POWER_LEVELS - 1;
+        }
+      }
+
+      // Link lost, go back to the profile both ends fall back to
+      if (rf_use_rate_adapt && rf_profile != RF_RATE_BASE_PROFILE) {
+        if (rf_receiving) {
+          rf_receive_off();
+        }
+        switch_profile(RF_RATE_BASE_PROFILE);
+      }
+      break;
+    }
+  }
+
+  // Send again only the messages that haven't been acknowledged
+  rf_win_burst = ~rf_win_acked & ((1 << rf_win_count) - 1);
+  for (i = 0; i < rf_win_count; ++i) {
+    offset += rf_win_len[i];
+  }
+
+  // Fill the rest of the window with new messages
+  window = rf_arq_window > 0 ? rf_arq_window : 1;
+  while (rf_win_count < window) {
+    len = next_msg_len(offset, force);
+    if (len == 0) {
+      break;
+    }
+
+    rf_win_len[rf_win_count] = len;
+    rf_win_tries[rf_win_count] = 0;
+    rf_win_burst |= 1 << rf_win_count;
+    ++rf_win_count;
+    offset += len;
+    ++sent;
+  }
+
+  // Nothing to send
+  if (rf_win_burst == 0) {
+    // Enable interrupts
+    __bis_status_register(GIE);
+    return 0;
   }
 
-  // Radio expects first byte to be packet len (excluding the len byte itself)
-  RfTxBuffer[0] = len;
-  // Copy data received over uart to RF TX buffer
-  for (x = 0; x < len; ++x) {
-    RfTxBuffer[x+1] = RfTxQueue[x];
+  // Change to the channel being tried
+  if (rf_hop_mode != RF_HOP_OFF &&
+      rf_hop_table[(rf_hop_index + rf_hop_scan) % RF_CHANNELS] != rf_channel) {
+    if (rf_receiving) {
+      rf_receive_off();
+    }
+    tune_hop_channel();
   }
 
-  // If we have more data to send, move them in front of the buffer
-  if (len != RfTxQueue_i) {
-    for (x = 0; x < RfTxQueue_i - len; ++x) {
-      RfTxQueue[x] = RfTxQueue[x+len];
+  if (rf_use_csma) {
+    // Listen before talk, back off if someone else is sending
+    if (!channel_clear()) {
+      start_backoff();
+
+      // Enable interrupts
+      __bis_status_register(GIE);
+      return sent;
     }
-    RfTxQueue_i -= len;
+
+    // Stop receiving but leave the radio in RX, so that it only starts
+    // TX if the channel is still clear (MCSM1.CCA_MODE)
+    RF1AIE &= ~(BIT9 | BIT0);
+    RF1AIFG &= ~(BIT9 | BIT0);
+    rf_receiving = 0;
   } else {
-    // All data sent, clear uart buffers
-    RfTxQueue_i = 0;
+    // Stop receive mode
+    if (rf_receiving) {
+      rf_receive_off();
+    }
+    calibrate();
   }
 
-  // Stop receive mode
-  if (rf_receiving) {
-    rf_receive_off();
+  // Send the messages over RF straight from the queue. The rest of the
+  // burst is sent from the interrupt handler.
+  set_tx_power(peer_tx_power(rf_tx_dst));
+  for (i = 0; !(rf_win_burst & (1 << i)); ++i);
+  if (rf_use_long_preamble) {
+    // Start TX with an empty FIFO, the radio sends preamble until the
+    // first message is written
+    rf_transmitting = 1;
+    Strobe(RF_STX);
+  } else {
+    transmit_window_msg();
   }
 
-  // Send buffer over RF (len +1 for length byte)
-  rf_transmitting = 1;
-  len = RfTxBuffer[0];
-  transmit_msg((unsigned char*)RfTxBuffer, len + 1);
+  // Channel became busy just before STX and the radio stayed in RX
+  if (rf_use_csma && !tx_started()) {
+    RF1AIE &= ~(BIT9 | BIT2);
+    Strobe(RF_SIDLE);
+    Strobe(RF_SFTX);
+    Strobe(RF_SFRX);
+    rf_transmitting = 0;
+    if (!rf_use_long_preamble) {
+      --rf_win_tries[i];
+    }
+
+    rf_receive_on();
+    start_backoff();
+
+    // Enable interrupts
+    __bis_status_register(GIE);
+    return sent;
+  }
+
+  rf_csma_be = RF_CSMA_MIN_BE;
+
+  // Let the preamble run long enough for a WOR receiver to wake up
+  if (rf_use_long_preamble) {
+    rf_preamble = 1;
+    timer_timeout_set(RF_WOR_PREAMBLE_MS);
+  }
 
   // Enable interrupts
   __bis_status_register(GIE);
 
-  return len;
+  return sent;
 }
 
 
 
 /*
- * Called from interrupt handler to handle a received packet from radio
+ * Set the amount of messages sent before waiting for an ACK. 0 disables
+ * ACKs, 1 waits for an ACK after every message. With a larger window
+ * only the messages missing from the receiver are sent again. Received
+ * messages are always acknowledged when the sender requests it.
  */
-static void handle_rf_rx_packet(void)
+void rf_arq_enable(uint8_t window)
 {
-  unsigned char x;
-  unsigned char RxStatus;
+  if (window > RF_ARQ_MAX_WINDOW) {
+    window = RF_ARQ_MAX_WINDOW;
+  }
 
-  // Radio is in IDLE after receiving a message (See MCSM0 default values)
-  rf_receiving = 0;
+  rf_arq_window = window;
+}
 
-  // Validate radio state
-  RxStatus = Strobe(RF_SNOP);
-  if ((RxStatus & CC430_STATE_MASK) != CC430_STATE_IDLE) {
-    rf_error = 1;
-    goto rx_error;
-  }
 
-  // Read the length byte from the FIFO
-  RfRxBufferLength = ReadSingleReg(RXBYTES);
 
-  // Must have at least 4 bytes (len <payload> RSSI CRC) for a valid packet
-  if (RfRxBufferLength < 4) {
-    goto rx_error;
-  }
+/*
+ * Check that the channel is clear before sending. ACKs and the rest of a
+ * burst are sent without checking, the channel is already ours.
+ */
+void rf_csma_enable(uint8_t enable)
+{
+  rf_use_csma = enable;
+}
 
-  // Read the packet data
-  ReadBurstReg(RF_RXFIFORD, (unsigned char *)RfRxBuffer, RfRxBufferLength);
 
-  // Verify CRC
-  if(!(RfRxBuffer[RfRxBufferLength - 1] & CRC_OK)) {
-    goto rx_error;
-  }
 
-  // FIXME: use uart API instead of directly poking the buffers
+/*
+ * Send the first message of each burst after a preamble long enough for
+ * a receiver in WOR mode to wake up and catch it
+ */
+void rf_long_preamble(uint8_t enable)
+{
+  rf_use_long_preamble = enable;
+}
 
-  // If there's not enough space for new data in uart tx buffer, discard new data
-  if (UartTxBufferLength + (RfRxBufferLength - 3) > UART_BUF_LEN) {
-    goto failed_to_receive;
-  }
 
-  // Append the RF RX buffer to Uart TX, skipping the length, RSSI and CRC/Quality bytes
-  for (x = 0; x < RfRxBufferLength - 3; ++x) {
-    UartTxBuffer[UartTxBufferLength + x] = RfRxBuffer[x+1];
-  }
-  UartTxBufferLength += (RfRxBufferLength - 3);
 
-  {
-    // DEBUG: Write RSSI to UartTxBuffer
-    // Remove \r\n
-    UartTxBufferLength -= 2;
-    UartTxBuffer[UartTxBufferLength++] = ' ';
-    unsigned char len;
-    volatile unsigned char *buf = &UartTxBuffer[UartTxBufferLength];
-    unsigned char value = RfRxBuffer[RfRxBufferLength - 2];
-    unsigned char max_len = UART_BUF_LEN - UartTxBufferLength;
-    int16_t rssi;
-
-    // Convert RSSI to 0-255, 255 being the best signal
-    if (value >= 128) {
-      rssi = value - 256;
-    } else {
-      rssi = value;
-    }
-    rssi -= 2*74; // double RSSI offset from data sheet
+/*
+ * Send and receive with forward error correction and interleaving
+ * (MDMCFG1.FEC_EN), in fixed length packets of RF_FEC_PKTLEN bytes. The
+ * payload is then at most RF_FEC_PAYLOAD_LEN bytes. All nodes must use
+ * the same mode. Set before rf_init().
+ */
+void rf_fec_enable(uint8_t enable)
+{
+  rf_use_fec = enable;
+}
 
-    // turn negative value to 0-255, 255 being the best signal
-    rssi += 276;
 
-    len = sc_itoa(rssi, (unsigned char *)buf, max_len);
-    if (len == 0) {
-      UartTxBuffer[UartTxBufferLength] = 'X';
-      ++len;
-    }
-    UartTxBuffer[UartTxBufferLength + len++] = ' ';
-    UartTxBufferLength += len;
-  }
 
-  {
-    // DEBUG: Write CRC/LQI to UartTxBuffer
-    unsigned char len;
-    volatile unsigned char *buf = &UartTxBuffer[UartTxBufferLength];
-    unsigned char value = RfRxBuffer[RfRxBufferLength - 1];
-    unsigned char max_len = UART_BUF_LEN - UartTxBufferLength;
-    len = sc_itoa(value, (unsigned char *)buf, max_len);
-    if (len == 0) {
-      UartTxBuffer[UartTxBufferLength] = 'X';
-      ++len;
-    }
-    UartTxBuffer[UartTxBufferLength + len++] = '\r';
-    UartTxBuffer[UartTxBufferLength + len++] = '\n';
-    UartTxBufferLength += len;
+/*
+ * Return the payload one packet can carry in the current mode
+ */
+static uint8_t packet_payload(void)
+{
+  return rf_use_fec ? RF_FEC_PAYLOAD_LEN : PAYLOAD_LEN;
+}
+
+
+
+/*
+ * Return the max payload of a message in the current mode, less the
+ * space kept for the relay header
+ */
+uint8_t rf_max_payload(void)
+{
+  return packet_payload() - RF_PAYLOAD_RESERVE;
+}
+
+
+
+/*
+ * Change the data rate profile (RF_PROFILE_*). The radio must be idle and
+ * the other end must use the same profile.
+ */
+void rf_set_profile(uint8_t profile)
+{
+  switch_profile(profile);
+}
+
+
+
+/*
+ * Adapt the data rate to the link: step up when the ACKs show enough RSSI
+ * and LQI margin for a faster profile, step down when the margin runs
+ * out. Both ends of the link must enable it. Not for a gateway serving
+ * several sensors, as it can listen on one profile only. The link starts
+ * from RF_RATE_BASE_PROFILE, so the radio must be idle.
+ */
+void rf_rate_adapt_enable(uint8_t enable)
+{
+  rf_use_rate_adapt = enable;
+
+  if (enable) {
+    switch_profile(RF_RATE_BASE_PROFILE);
   }
+}
 
-  // Send the first byte to Uart
-  //while (!(UCA0IFG&UCTXIFG));           // USCI_A0 TX buffer ready?
-  UCA0TXBUF = UartTxBuffer[UartTxBuffer_i]; // Send first byte
-  return;
 
- rx_error:
-  rf_error = 1;
 
- failed_to_receive:
-  RfRxBufferLength = 0;
-  return;
+/*
+ * Control the TX power by the RSSI the receiver reports in its ACKs.
+ * Needs acknowledged transfers, see rf_arq_enable(). Starts from full
+ * power.
+ */
+void rf_tx_power_control(uint8_t enable)
+{
+  rf_use_tx_power_control = enable;
+  reset_tx_power();
+  set_tx_power(RF_TX_POWER_LEVELS - 1);
 }
 
 
 
+/*
+ * Set the address of this node. The radio then drops packets to other
+ * nodes, except broadcasts. 0 turns the address check off. Set before
+ * rf_init().
+ */
+void rf_set_address(uint8_t addr)
+{
+  rf_address = addr;
+}
+
+
 
 /*
- * Start RF transmit with the given message
+ * Change the channel (CHANNR), when not hopping. The radio must be idle.
  */
-static void transmit_msg(unsigned char *buffer, unsigned char length)
+void rf_set_channel(uint8_t channel)
 {
-  // Falling edge of RFIFG9
-  RF1AIES |= BIT9;
+  rf_channel = channel;
+  WriteSingleReg(CHANNR, channel);
+  rf_fscal_loaded = RF_RX_NO_SLOT;
+}
 
-  // Clear pending interrupts
-  RF1AIFG &= ~BIT9;
 
-  // Enable TX end-of-packet interrupt
-  RF1AIE |= BIT9;
 
-  WriteBurstReg(RF_TXFIFOWR, buffer, length);
+/*
+ * Tell the current temperature, to calibrate the synthesizer again when
+ * it has changed enough since the last calibration
+ */
+void rf_fscal_temperature(int8_t celsius)
+{
+  int8_t diff = celsius - rf_fscal_temp;
 
-  // Start transmit
-  Strobe(RF_STX);
+  if (rf_fscal_temp == RF_FSCAL_NO_TEMP) {
+    rf_fscal_temp = celsius;
+    return;
+  }
+
+  if (diff >= RF_FSCAL_TEMP_DELTA || diff <= -RF_FSCAL_TEMP_DELTA) {
+    rf_fscal_temp = celsius;
+    rf_fscal_valid = 0;
+  }
+}
+
+
+
+/*
+ * Hop over RF_CHANNELS channels in the order given by RF_HOP_SEED. One
+ * node, usually the gateway, is the master and the rest follow it. The
+ * master must call rf_hop_poll() from its main loop. Followers need ARQ,
+ * and at least RF_CHANNELS - 1 retries to always find the master. The
+ * radio must be idle.
+ */
+void rf_hop_enable(enum RF_HOP_MODE mode)
+{
+  uint16_t state = RF_HOP_SEED;
+  uint8_t i;
+  uint8_t j;
+  unsigned char tmp;
+
+  // Shuffle the channels with a generator every node runs the same way
+  for (i = 0; i < RF_CHANNELS; ++i) {
+    rf_hop_table[i] = RF_CHANNEL_FIRST + i;
+  }
+  for (i = RF_CHANNELS - 1; i > 0; --i) {
+    state ^= state << 7;
+    state ^= state >> 9;
+    state ^= state << 8;
+    j = state % (i + 1);
+    tmp = rf_hop_table[i];
+    rf_hop_table[i] = rf_hop_table[j];
+    rf_hop_table[j] = tmp;
+  }
+
+  rf_hop_mode = mode;
+  rf_hop_index = 0;
+  rf_hop_scan = 0;
+
+  if (mode == RF_HOP_MASTER) {
+    timer_interval_set(RF_HOP_DWELL_MS);
+  } else {
+    timer_interval_clear();
+  }
+
+  if (mode != RF_HOP_OFF) {
+    tune_hop_channel();
+  }
+}
+
+
+
+/*
+ * Move the hop master to the next channel when the dwell time is over.
+ * Waits for a packet being received or an exchange in progress to end.
+ */
+void rf_hop_poll(void)
+{
+  unsigned char receiving;
+
+  if (rf_hop_mode != RF_HOP_MASTER || timer_interval_count == 0) {
+    return;
+  }
+
+  // Disable interrupts to make sure the radio state isn't changed in the middle
+  __bic_status_register(GIE);
+
+  receiving = rf_receiving;
+  if (rf_transmitting || rf_arq_waiting || rf_backoff || rf_preamble ||
+      rf_rx_len > 0 ||
+      (receiving && (ReadSingleReg(PKTSTATUS) & RF_PKTSTATUS_SFD))) {
+    // Enable interrupts
+    __bis_status_register(GIE);
+    return;
+  }
+
+  rf_hop_index = (rf_hop_index + timer_interval_count) % RF_CHANNELS;
+  timer_interval_count = 0;
+
+  if (receiving) {
+    rf_receive_off();
+    rf_receive_on();
+  }
+
+  // Enable interrupts
+  __bis_status_register(GIE);
+}
+
+
+
+/*
+ * Do the radio reconfiguration left over from the interrupt handler, and
+ * fall back to the base profile if there has been no traffic on a faster
+ * one for a while. Call from the main loop.
+ */
+void rf_poll(void)
+{
+  // Disable interrupts to make sure the radio state isn't changed in the middle
+  __bic_status_register(GIE);
+
+  poll_radio();
+
+  // Enable interrupts
+  __bis_status_register(GIE);
+}
+
+
+
+/*
+ * Return the payload length of the oldest received packet, or 0 if none
+ */
+uint8_t rf_receive_pending(void)
+{
+  if (RfRxQueueLength == 0) {
+    return 0;
+  }
+
+  return RfRxQueue[RfRxQueue_slots[RfRxQueue_head]][0] - RF_HDR_LEN;
+}
+
+
+
+/*
+ * Queue a message to the node at addr, or to all nodes with
+ * RF_ADDR_BROADCAST. The queue holds messages to one node at a time, so
+ * returns 0 without queueing if there are messages to another node
+ * still waiting, or if the queue is full. rf_append_msg() sends to the
+ * node given last.
+ */
+uint8_t rf_append_msg_to(uint8_t addr, unsigned char *buf, uint16_t len)
+{
+  // Disable interrupts to make sure RfTxQueue isn't modified in the middle
+  __bic_status_register(GIE);
+
+  if (RfTxQueueLength > 0 && (addr != rf_tx_dst || rf_tx_relay || rf_tx_pkt_count > 0)) {
+    // Enable interrupts
+    __bis_status_register(GIE);
+    return 0;
+  }
+  rf_tx_dst = addr;
+  rf_tx_relay = 0;
+
+  // Enable interrupts
+  __bis_status_register(GIE);
+
+  return rf_append_msg(buf, len);
+}
+
+
+
+/*
+ * Queue a packet relayed for another node to the node at addr. The
+ * payload starts with the relay header and goes out as one packet
+ * flagged with RF_FLAG_RELAY. Returns 0 without queueing if the queue
+ * isn't empty, or if the packet is too long.
+ */
+uint8_t rf_relay_msg_to(uint8_t addr, unsigned char *buf, uint16_t len)
+{
+  // Disable interrupts to make sure RfTxQueue isn't modified in the middle
+  __bic_status_register(GIE);
+
+  if (RfTxQueueLength > 0 || len > packet_payload()) {
+    // Enable interrupts
+    __bis_status_register(GIE);
+    return 0;
+  }
+  rf_tx_dst = addr;
+  rf_tx_relay = 1;
+
+  // Enable interrupts
+  __bis_status_register(GIE);
+
+  return rf_append_msg(buf, len);
+}
+
+
+
+/*
+ * Queue a message to the node at addr that goes out as one packet of
+ * its own, e.g. a frame of a binary protocol. The packet boundaries are
+ * kept without looking at the data. Returns 0 without queueing if the
+ * queue holds other messages or is full, or if the message doesn't fit
+ * in a packet.
+ */
+uint8_t rf_append_packet_to(uint8_t addr, unsigned char *buf, uint16_t len)
+{
+  // Disable interrupts to make sure RfTxQueue isn't modified in the middle
+  __bic_status_register(GIE);
+
+  if (len == 0 || len > rf_max_payload() ||
+      len > RF_QUEUE_LEN - RfTxQueueLength || rf_tx_pkt_count == RF_TX_PACKETS ||
+      (RfTxQueueLength > 0 && (addr != rf_tx_dst || rf_tx_relay || rf_tx_pkt_count == 0))) {
+    // Enable interrupts
+    __bis_status_register(GIE);
+    return 0;
+  }
+  rf_tx_dst = addr;
+  rf_tx_relay = 0;
+  rf_tx_pkt_len[(rf_tx_pkt_first + rf_tx_pkt_count) % RF_TX_PACKETS] = len;
+  ++rf_tx_pkt_count;
+
+  // Enable interrupts
+  __bis_status_register(GIE);
+
+  return rf_append_msg(buf, len);
+}
+
+
+
+/*
+ * Return the address of the sender of the oldest received packet
+ */
+uint8_t rf_receive_source(void)
+{
+  if (RfRxQueueLength == 0) {
+    return 0;
+  }
+
+  return RfRxQueue[RfRxQueue_slots[RfRxQueue_head]][1 + RF_HDR_SRC];
+}
+
+
+
+/*
+ * Return the link sequence number of the oldest received packet
+ */
+uint8_t rf_receive_seq(void)
+{
+  if (RfRxQueueLength == 0) {
+    return 0;
+  }
+
+  return RfRxQueue[RfRxQueue_slots[RfRxQueue_head]][1 + RF_HDR_SEQ];
+}
+
+
+
+/*
+ * Return 1 if the oldest received packet was relayed, its payload then
+ * starts with the relay header
+ */
+uint8_t rf_receive_relayed(void)
+{
+  if (RfRxQueueLength == 0) {
+    return 0;
+  }
+
+  return (RfRxQueue[RfRxQueue_slots[RfRxQueue_head]][1 + RF_HDR_FLAGS] & RF_FLAG_RELAY) != 0;
+}
+
+
+
+/*
+ * Copy the payload of the oldest received packet to buf (PAYLOAD_LEN
+ * bytes) and release it from the queue. Stores the raw RSSI and
+ * CRC/LQI status bytes of the packet. Returns the payload length, or 0
+ * if there are no packets.
+ */
+uint8_t rf_receive_packet(unsigned char *buf, uint8_t *rssi, uint8_t *lqi)
+{
+  uint8_t len = rf_receive_peek(buf, rssi, lqi);
+
+  rf_receive_release();
+
+  return len;
+}
+
+
+
+/*
+ * Copy the oldest received packet like rf_receive_packet(), but leave it
+ * in the queue, e.g. until there's room to pass it on
+ */
+uint8_t rf_receive_peek(unsigned char *buf, uint8_t *rssi, uint8_t *lqi)
+{
+  volatile unsigned char *packet;
+  uint8_t len;
+  uint8_t i;
+
+  if (RfRxQueueLength == 0) {
+    return 0;
+  }
+
+  packet = RfRxQueue[RfRxQueue_slots[RfRxQueue_head]];
+  len = packet[0] - RF_HDR_LEN;
+
+  for (i = 0; i < len; ++i) {
+    buf[i] = packet[i + 1 + RF_HDR_LEN];
+  }
+  *rssi = packet[len + 1 + RF_HDR_LEN];
+  *lqi = packet[len + 2 + RF_HDR_LEN];
+
+  return len;
+}
+
+
+
+/*
+ * Release the oldest received packet from the queue
+ */
+void rf_receive_release(void)
+{
+  uint8_t slot;
+
+  if (RfRxQueueLength == 0) {
+    return;
+  }
+
+  // Disable interrupts to make sure RfRxQueue isn't modified in the middle
+  __bic_status_register(GIE);
+
+  slot = RfRxQueue_slots[RfRxQueue_head];
+  if (++RfRxQueue_head == RF_RX_QUEUE_SLOTS) {
+    RfRxQueue_head = 0;
+  }
+  --RfRxQueueLength;
+  RfRxQueue_free |= 1 << slot;
+
+  // Enable interrupts
+  __bis_status_register(GIE);
+}
+
+
+
+/*
+ * Called from interrupt handler to handle a received packet from radio
+ */
+static void handle_rf_rx_packet(void)
+{
+  unsigned char RxStatus;
+  unsigned char flags;
+  unsigned char seq;
+  unsigned char src;
+  unsigned char ack_flags = RF_FLAG_ACK;
+  uint8_t peer;
+
+  // Radio is in IDLE after receiving a message (See MCSM0 default values)
+  rf_receiving = 0;
+
+  // Validate radio state
+  RxStatus = Strobe(RF_SNOP);
+  if ((RxStatus & CC430_STATE_MASK) != CC430_STATE_IDLE) {
+    rf_error = 1;
+    goto rx_error;
+  }
+
+  // Read the rest of the packet data
+  read_rx_fifo(0);
+
+  // Packet discarded
+  if (rf_rx_slot == 0) {
+    return;
+  }
+
+  // Fixed length packet of the FEC mode. Move the length byte from after
+  // the link header to the start and the status bytes after the payload,
+  // as in a variable length packet.
+  if (rf_use_fec) {
+    unsigned char len;
+    uint8_t i;
+
+    if (rf_rx_len != RF_FEC_PKTLEN + 2) {
+      return;
+    }
+    len = rf_rx_slot[RF_HDR_LEN];
+    if (len < RF_HDR_LEN || len > RF_FEC_PKTLEN - 1) {
+      return;
+    }
+
+    for (i = RF_HDR_LEN; i > 0; --i) {
+      rf_rx_slot[i] = rf_rx_slot[i - 1];
+    }
+    rf_rx_slot[0] = len;
+    rf_rx_slot[len + 1] = rf_rx_slot[rf_rx_len - 2];
+    rf_rx_slot[len + 2] = rf_rx_slot[rf_rx_len - 1];
+    rf_rx_len = len + 3;
+  }
+
+  // Must have at least len, header, RSSI and CRC for a valid packet.
+  // Broken packets are just dropped, the radio doesn't need a reset.
+  if (rf_rx_len < RF_HDR_LEN + 3 || rf_rx_len != rf_rx_slot[0] + 3) {
+    return;
+  }
+
+  // Verify CRC
+  if(!(rf_rx_slot[rf_rx_len - 1] & CRC_OK)) {
+    return;
+  }
+
+  flags = rf_rx_slot[1 + RF_HDR_FLAGS];
+  seq = rf_rx_slot[1 + RF_HDR_SEQ];
+  src = rf_rx_slot[1 + RF_HDR_SRC];
+
+  // ACK for the messages we are waiting for
+  if (flags & RF_FLAG_ACK) {
+    if (rf_rx_slot[0] == RF_HDR_LEN + RF_ACK_LEN) {
+      handle_ack(flags, seq, rf_rx_slot[1 + RF_HDR_LEN],
+                 rf_rx_slot[2 + RF_HDR_LEN], rf_rx_slot[3 + RF_HDR_LEN]);
+    }
+    return;
+  }
+
+  // Traffic from the other end, keep the current profile for a while
+  start_rate_lease();
+
+  // Change the data rate after the ACK, if asked and supported
+  if (rf_use_rate_adapt && (flags & RF_FLAG_RATE) &&
+      (flags & RF_FLAG_PROFILE) < RF_PROFILES) {
+    ack_flags |= flags & (RF_FLAG_RATE | RF_FLAG_PROFILE);
+  }
+
+  // No space in the queue for a message (or an empty message), drop it
+  // without an ACK so that the sender tries again later
+  if (rf_rx_slot_no == RF_RX_NO_SLOT || rf_rx_len == RF_HDR_LEN + 3) {
+    return;
+  }
+
+  // Message of a window transfer. Acknowledge the whole window at the
+  // end of the burst, until then keep listening for the rest of it.
+  if (flags & RF_FLAG_WINDOW) {
+    // Window transfer from another sender, pass on what the previous
+    // one left held. Keep where each sender was, so that its
+    // retransmissions are still dropped when it comes back.
+    if (src != rf_rx_win_src) {
+      release_rx_hold();
+      if (rf_rx_win_src != RF_ADDR_BROADCAST) {
+        peer = rx_peer(rf_rx_win_src);
+        rf_rx_peer_seq[peer] = rf_rx_next_seq;
+        rf_rx_peer_win |= 1 << peer;
+      }
+      peer = rx_peer(src);
+      rf_rx_win_src = src;
+      rf_rx_next_seq = (rf_rx_peer_win & (1 << peer)) ? rf_rx_peer_seq[peer] : seq;
+    }
+    receive_window_msg(seq);
+    if (flags & RF_FLAG_ACK_REQ) {
+      send_ack(ack_flags | RF_FLAG_WINDOW, rf_rx_next_seq);
+    } else {
+      rf_receive_on();
+    }
+    return;
+  }
+
+  if (flags & RF_FLAG_ACK_REQ) {
+    send_ack(ack_flags, seq);
+
+    // Our ACK was lost and the sender retransmitted the message
+    peer = rx_peer(src);
+    if (seq == rf_rx_peer_seq[peer] && rf_rx_slot[0] == rf_rx_peer_len[peer]) {
+      return;
+    }
+    rf_rx_peer_seq[peer] = seq;
+    rf_rx_peer_len[peer] = rf_rx_slot[0];
+    rf_rx_peer_win &= ~(1 << peer);
+  }
+
+  // Hand the packet over to the main loop
+  deliver_rx_slot(rf_rx_slot_no);
+  return;
+
+ rx_error:
+  rf_error = 1;
+  return;
+}
+
+
+
+/*
+ * Called from interrupt handler to store a received window message.
+ * Messages arriving ahead of a missing one are held in their slots until
+ * the missing one is received.
+ */
+static void receive_window_msg(unsigned char seq)
+{
+  uint8_t ahead = seq - rf_rx_next_seq;
+
+  // The next message in order
+  if (ahead == 0) {
+    deliver_rx_slot(rf_rx_slot_no);
+    advance_rx_window();
+    return;
+  }
+
+  // Ahead of a missing message, hold it unless we already have it
+  if (ahead < RF_ARQ_MAX_WINDOW) {
+    if (rf_rx_hold[ahead - 1] == RF_RX_NO_SLOT) {
+      RfRxQueue_free &= ~(1 << rf_rx_slot_no);
+      rf_rx_hold[ahead - 1] = rf_rx_slot_no;
+    }
+    return;
+  }
+
+  // Already received, our ACK was lost
+  if (ahead >= 256 - RF_ARQ_MAX_WINDOW) {
+    return;
+  }
+
+  // Sender has given up the missing messages (or restarted). Pass on
+  // what we have and start over from this message.
+  release_rx_hold();
+  rf_rx_next_seq = seq;
+  deliver_rx_slot(rf_rx_slot_no);
+  advance_rx_window();
+}
+
+
+
+/*
+ * Deliver the held window messages in order, skipping the missing ones.
+ * They have been acknowledged, so the sender won't send them again.
+ */
+static void release_rx_hold(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < RF_ARQ_MAX_WINDOW - 1; ++i) {
+    if (rf_rx_hold[i] != RF_RX_NO_SLOT) {
+      deliver_rx_slot(rf_rx_hold[i]);
+      rf_rx_hold[i] = RF_RX_NO_SLOT;
+    }
+  }
+}
+
+
+
+/*
+ * Move the receive window past the message just delivered and deliver the
+ * held messages that are now in order
+ */
+static void advance_rx_window(void)
+{
+  uint8_t slot;
+  uint8_t i;
+
+  do {
+    ++rf_rx_next_seq;
+
+    slot = rf_rx_hold[0];
+    for (i = 0; i < RF_ARQ_MAX_WINDOW - 2; ++i) {
+      rf_rx_hold[i] = rf_rx_hold[i + 1];
+    }
+    rf_rx_hold[RF_ARQ_MAX_WINDOW - 2] = RF_RX_NO_SLOT;
+
+    if (slot != RF_RX_NO_SLOT) {
+      deliver_rx_slot(slot);
+    }
+  } while (slot != RF_RX_NO_SLOT);
+}
+
+
+
+/*
+ * Hand the packet in the slot over to the main loop
+ */
+static void deliver_rx_slot(uint8_t slot)
+{
+  uint8_t i = RfRxQueue_head + RfRxQueueLength;
+
+  if (i >= RF_RX_QUEUE_SLOTS) {
+    i -= RF_RX_QUEUE_SLOTS;
+  }
+
+  RfRxQueue_slots[i] = slot;
+  RfRxQueue_free &= ~(1 << slot);
+  ++RfRxQueueLength;
+}
+
+
+
+/*
+ * Move bytes from the RX FIFO to the RX queue slot, leaving keep bytes in
+ * the FIFO. The FIFO must not be emptied while a packet is still being
+ * received.
+ */
+static void read_rx_fifo(unsigned char keep)
+{
+  unsigned char rxbytes;
+  unsigned char count;
+
+  // RXBYTES must be read twice to get a consistent value (see errata)
+  do {
+    rxbytes = ReadSingleReg(RXBYTES);
+  } while (rxbytes != ReadSingleReg(RXBYTES));
+
+  count = rxbytes & ~CC430_RXBYTES_OVERFLOW;
+  if (count <= keep) {
+    return;
+  }
+  count -= keep;
+
+  // Packet doesn't fit into the buffer
+  if (rf_rx_slot != 0 && rf_rx_len + count > rf_rx_size) {
+    if (rf_rx_slot != rf_rx_ack) {
+      rf_error = 1;
+    }
+    rf_rx_slot = 0;
+  }
+
+  // Nowhere to store the data, read it out of the FIFO a byte at a time
+  // and discard it. A FIFO sized buffer would be too much for the
+  // interrupt handler's stack.
+  if (rf_rx_slot == 0) {
+    unsigned char discard;
+
+    while (count-- > 0) {
+      ReadBurstReg(RF_RXFIFORD, &discard, 1);
+    }
+    return;
+  }
+
+  ReadBurstReg(RF_RXFIFORD, (unsigned char *)&rf_rx_slot[rf_rx_len], count);
+  rf_rx_len += count;
+}
+
+
+
+
+/*
+ * Start RF transmit with the header and the given amount of bytes from
+ * RfTxQueue, starting at queue index pos
+ */
+static void transmit_msg(unsigned char *header, unsigned char header_len,
+                         uint16_t pos, unsigned char length)
+{
+  rf_tx_pos = pos;
+  rf_tx_left = length;
+  rf_tx_pad = 0;
+  rf_tx_flags = header[RF_HDR_FLAGS];
+  rf_transmitting = 1;
+
+  // Falling edge of RFIFG9 (end of packet) and RFIFG2 (TX FIFO below threshold)
+  RF1AIES |= BIT9 | BIT2;
+
+  // Clear pending interrupts
+  RF1AIFG &= ~(BIT9 | BIT2);
+
+  // Enable TX end-of-packet interrupt
+  RF1AIE |= BIT9;
+
+  if (rf_use_fec) {
+    // Fixed length, the length byte after the link header tells how much
+    // of the packet is padding
+    rf_tx_pad = RF_FEC_PKTLEN - 1 - header_len - length;
+    WriteBurstReg(RF_TXFIFOWR, header, RF_HDR_LEN);
+    WriteSingleReg(RF_TXFIFOWR, length + header_len);
+    WriteBurstReg(RF_TXFIFOWR, &header[RF_HDR_LEN], header_len - RF_HDR_LEN);
+  } else {
+    // Radio expects first byte to be packet len (excluding the len byte itself)
+    WriteSingleReg(RF_TXFIFOWR, length + header_len);
+
+    // Link header
+    WriteBurstReg(RF_TXFIFOWR, header, header_len);
+  }
+
+  // Fill the FIFO, the rest is written as the FIFO drains
+  write_tx_fifo(RF_FIFO_LEN - 1 - header_len);
+  if (rf_tx_left > 0 || rf_tx_pad > 0) {
+    RF1AIE |= BIT2;
+  }
+
+  // Start transmit
+  Strobe(RF_STX);
+}
+
+
+
+/*
+ * Send the first message still left in the current burst
+ */
+static void transmit_window_msg(void)
+{
+  unsigned char header[RF_HDR_LEN];
+  uint16_t pos = RfTxQueue_head;
+  uint8_t i;
+
+  for (i = 0; !(rf_win_burst & (1 << i)); ++i) {
+    pos += rf_win_len[i];
+  }
+  rf_win_burst &= ~(1 << i);
+  ++rf_win_tries[i];
+
+  // Request an ACK for the last message of the burst. Broadcasts are
+  // not acknowledged, as all the receivers would answer at once.
+  header[RF_HDR_DST] = rf_tx_dst;
+  header[RF_HDR_SRC] = rf_address;
+  header[RF_HDR_FLAGS] = 0;
+  if (rf_tx_dst != RF_ADDR_BROADCAST) {
+    if (rf_arq_window > 1) {
+      header[RF_HDR_FLAGS] |= RF_FLAG_WINDOW;
+    }
+    if (rf_arq_window > 0 && rf_win_burst == 0) {
+      header[RF_HDR_FLAGS] |= RF_FLAG_ACK_REQ;
+    }
+  }
+  if (rf_rate_req != RF_NO_PROFILE) {
+    header[RF_HDR_FLAGS] |= RF_FLAG_RATE | rf_rate_req;
+  }
+  if (rf_tx_relay) {
+    header[RF_HDR_FLAGS] |= RF_FLAG_RELAY;
+  }
+  header[RF_HDR_SEQ] = rf_tx_seq + i;
+
+  transmit_msg(header, RF_HDR_LEN, queue_index(pos), rf_win_len[i]);
+}
+
+
+
+/*
+ * Return 1 if the channel is clear: the radio has been listening, the
+ * RSSI is below the carrier sense threshold and no packet is coming in.
+ */
+static uint8_t channel_clear(void)
+{
+  unsigned char status;
+
+  // Part of a packet already received
+  if (rf_rx_len > 0) {
+    return 0;
+  }
+
+  // The radio may be asleep in WOR mode
+  if (rf_wor_active) {
+    rf_receive_off();
+  }
+
+  // The RSSI is valid only after listening for a while, so start
+  // listening and check again after the backoff
+  if (!rf_receiving) {
+    rf_receive_on();
+    return 0;
+  }
+
+  // Just started listening. Back off while the radio is still on the
+  // way to RX, then give the RSSI time to settle.
+  if (rf_rssi_settling) {
+    if ((ReadSingleReg(MARCSTATE) & RF_MARCSTATE_MASK) != RF_MARCSTATE_RX) {
+      return 0;
+    }
+    busysleep_us(rf_rssi_valid_us[rf_profile]);
+    rf_rssi_settling = 0;
+  }
+
+  status = ReadSingleReg(PKTSTATUS);
+
+  return (status & RF_PKTSTATUS_CCA) && !(status & RF_PKTSTATUS_SFD);
+}
+
+
+
+/*
+ * Check if a STX given in RX was accepted. The radio moves through the
+ * RX to TX switch after a while, so poll until it leaves RX.
+ */
+static uint8_t tx_started(void)
+{
+  uint16_t waited;
+
+  for (waited = 0; waited < RF_STX_TIMEOUT_US; waited += 10) {
+    if ((ReadSingleReg(MARCSTATE) & RF_MARCSTATE_MASK) != RF_MARCSTATE_RX) {
+      return 1;
+    }
+    busysleep_us(10);
+  }
+
+  return (ReadSingleReg(MARCSTATE) & RF_MARCSTATE_MASK) != RF_MARCSTATE_RX;
+}
+
+
+
+/*
+ * Wait for a random amount of backoff slots before the next try. The
+ * range doubles after each busy channel.
+ */
+static void start_backoff(void)
+{
+  uint16_t slots = rf_rand() & ((1 << rf_csma_be) - 1);
+
+  if (rf_csma_be < RF_CSMA_MAX_BE) {
+    ++rf_csma_be;
+  }
+
+  rf_backoff = 1;
+  timer_timeout_set((slots + 1) * RF_CSMA_SLOT_MS);
+}
+
+
+
+/*
+ * Pseudo random number for the backoff. The RSSI noise is mixed in, so
+ * that nodes with the same firmware don't back off in lockstep.
+ */
+static uint16_t rf_rand(void)
+{
+  rf_rand_state ^= ReadSingleReg(RSSI);
+  if (rf_rand_state == 0) {
+    rf_rand_state = 0xACE1;
+  }
+
+  // xorshift
+  rf_rand_state ^= rf_rand_state << 7;
+  rf_rand_state ^= rf_rand_state >> 9;
+  rf_rand_state ^= rf_rand_state << 8;
+
+  return rf_rand_state;
+}
+
+
+
+/*
+ * Return the payload length of the next message in the queue after the
+ * first offset bytes, or 0 if there isn't a whole message yet
+ */
+static unsigned char next_msg_len(uint16_t offset, enum RF_SEND_MSG force)
+{
+  unsigned char x;
+  unsigned char max_len;
+  unsigned char payload_len;
+  uint16_t left;
+  uint16_t i;
+
+  // Nothing to send
+  if (RfTxQueueLength <= offset) {
+    return 0;
+  }
+
+  // One packet can carry at most PAYLOAD_LEN bytes, less in the FEC mode.
+  // Only a relayed packet may use the space kept for the relay header.
+  // The queue holds more than 255 bytes, so cap before narrowing.
+  payload_len = rf_tx_relay ? packet_payload() : rf_max_payload();
+  left = RfTxQueueLength - offset;
+  if (left > payload_len) {
+    left = payload_len;
+  }
+  max_len = left;
+
+  // The window holds whole packets of rf_append_packet_to(), the next
+  // one is right after them
+  if (rf_tx_pkt_count > 0) {
+    if (rf_win_count >= rf_tx_pkt_count) {
+      return 0;
+    }
+    return rf_tx_pkt_len[(rf_tx_pkt_first + rf_win_count) % RF_TX_PACKETS];
+  }
+
+  // A relayed packet goes out whole, whatever it has in it
+  if (force || rf_tx_relay) {
+    return max_len;
+  }
+
+  // Find the end of the first message
+  i = queue_index(RfTxQueue_head + offset);
+  for (x = 0; x < max_len; x++) {
+    if (RfTxQueue[i] == '\n') {
+      return x + 1;
+    }
+    i = queue_index(i + 1);
+  }
+
+  // No newline, send a full packet if there's enough data for one
+  if (max_len == payload_len) {
+    return max_len;
+  }
+
+  return 0;
+}
+
+
+
+/*
+ * Acknowledge a received message. Called from the interrupt handler
+ * while the radio is idle after the end of the packet. A window ACK has
+ * the next sequence number expected and a bit mask of the messages held
+ * after it. All ACKs report the RSSI and LQI of the received message.
+ */
+static void send_ack(unsigned char flags, unsigned char seq)
+{
+  unsigned char header[RF_HDR_LEN + RF_ACK_LEN];
+  uint8_t i;
+
+  header[RF_HDR_DST] = rf_rx_slot[1 + RF_HDR_SRC];
+  header[RF_HDR_SRC] = rf_address;
+  header[RF_HDR_FLAGS] = flags;
+  header[RF_HDR_SEQ] = seq;
+  header[RF_HDR_LEN] = 0;
+  header[RF_HDR_LEN + 1] = rf_rx_slot[rf_rx_len - 2];
+  header[RF_HDR_LEN + 2] = rf_rx_slot[rf_rx_len - 1];
+
+  if (flags & RF_FLAG_WINDOW) {
+    for (i = 0; i < RF_ARQ_MAX_WINDOW - 1; ++i) {
+      if (rf_rx_hold[i] != RF_RX_NO_SLOT) {
+        header[RF_HDR_LEN] |= 1 << i;
+      }
+    }
+  }
+
+  set_tx_power(peer_tx_power(header[RF_HDR_DST]));
+  transmit_msg(header, sizeof(header), 0, 0);
+}
+
+
+
+/*
+ * Mark the messages of the window acknowledged by a received ACK and
+ * release the ones at the start of the window from the queue
+ */
+static void handle_ack(unsigned char flags, unsigned char seq,
+                       unsigned char map, unsigned char rssi, unsigned char lqi)
+{
+  uint8_t ahead = seq - rf_tx_seq;
+  uint8_t i;
+  int16_t dbm;
+
+  if (!rf_arq_waiting) {
+    return;
+  }
+
+  if (flags & RF_FLAG_WINDOW) {
+    // Stale ACK
+    if (ahead > rf_win_count) {
+      return;
+    }
+
+    // Everything before seq, and the messages held by the receiver
+    rf_win_acked |= (1 << ahead) - 1;
+    rf_win_acked |= (map << (ahead + 1)) & ((1 << rf_win_count) - 1);
+  } else {
+    // Stale ACK
+    if (ahead >= rf_win_count) {
+      return;
+    }
+
+    rf_win_acked |= 1 << ahead;
+  }
+
+  timer_timeout_clear();
+  rf_arq_waiting = 0;
+
+  for (i = 0; rf_win_acked & (1 << i); ++i);
+  release_window(i);
+
+  // A follower found the master. The master keeps its own schedule.
+  if (rf_hop_mode == RF_HOP_FOLLOWER) {
+    rf_hop_index = (rf_hop_index + rf_hop_scan) % RF_CHANNELS;
+  }
+  rf_hop_scan = 0;
+
+  // RSSI of our message at the receiver in dBm, see the data sheet for
+  // the offset
+  dbm = (rssi >= 128 ? rssi - 256 : rssi) / 2 - 74;
+
+  // The receiver agreed to change the data rate, switch from the main loop
+  if ((flags & RF_FLAG_RATE) && rf_rate_req == (flags & RF_FLAG_PROFILE)) {
+    rf_profile_next = rf_rate_req;
+    rf_rate_req = RF_NO_PROFILE;
+  } else {
+    if (rf_use_rate_adapt) {
+      // Judge the link by what it would be at full power
+      adapt_rate(dbm + rf_tx_power_dbm[RF_TX_POWER_LEVELS - 1] -
+                 rf_tx_power_dbm[peer_tx_power(rf_tx_dst)], lqi);
+    }
+    if (rf_use_tx_power_control) {
+      // The ACK is a packet received from the peer, so it gets an entry
+      adapt_tx_power(rx_peer(rf_tx_dst), dbm);
+    }
+  }
+
+  start_rate_lease();
+}
+
+
+
+/*
+ * Ask the receiver for a faster profile when the link has had enough
+ * margin for it for a while, or for a slower one when the margin is gone
+ */
+static void adapt_rate(int16_t dbm, unsigned char lqi)
+{
+  if (rf_rate_req != RF_NO_PROFILE) {
+    return;
+  }
+
+  if (rf_profile > 0 &&
+      dbm < rf_profile_sensitivity[rf_profile] + RF_RATE_MARGIN_DB / 2) {
+    rf_rate_req = rf_profile - 1;
+  } else if (rf_profile < RF_PROFILES - 1 &&
+             dbm >= rf_profile_sensitivity[rf_profile + 1] + RF_RATE_MARGIN_DB &&
+             (lqi & ~CRC_OK) <= RF_RATE_MAX_LQI) {
+    if (++rf_rate_good >= RF_RATE_UP_COUNT) {
+      rf_rate_req = rf_profile + 1;
+    }
+  } else {
+    rf_rate_good = 0;
+  }
+}
+
+
+
+/*
+ * Step the TX power towards a peer down while it still gets our messages
+ * with the target margin after the step, and up when the margin is gone
+ */
+static void adapt_tx_power(uint8_t peer, int16_t dbm)
+{
+  int16_t target = rf_profile_sensitivity[rf_profile] + RF_TX_POWER_MARGIN_DB;
+  uint8_t level = rf_rx_peer_power[peer];
+
+  if (dbm < target) {
+    if (level < RF_TX_POWER_LEVELS - 1) {
+      rf_rx_peer_power[peer] = level + 1;
+    }
+  } else if (level > 0 &&
+             dbm - (rf_tx_power_dbm[level] - rf_tx_power_dbm[level - 1]) >= target) {
+    rf_rx_peer_power[peer] = level - 1;
+  }
+}
+
+
+
+/*
+ * Set the TX power level. The radio must not be transmitting.
+ */
+static void set_tx_power(uint8_t level)
+{
+  if (level == rf_tx_power) {
+    return;
+  }
+
+  rf_tx_power = level;
+  WriteSinglePATable(rf_tx_power_patable[level]);
+}
+
+
+
+/*
+ * Return the TX power level to use towards addr. Broadcasts, nodes not
+ * heard from, and all packets without TX power control, go out at full
+ * power. Sending doesn't take a peer entry from another node.
+ */
+static uint8_t peer_tx_power(unsigned char addr)
+{
+  uint8_t peer;
+
+  if (!rf_use_tx_power_control) {
+    return RF_TX_POWER_LEVELS - 1;
+  }
+
+  peer = find_peer(addr);
+  if (peer == RF_RX_PEERS) {
+    return RF_TX_POWER_LEVELS - 1;
+  }
+
+  return rf_rx_peer_power[peer];
+}
+
+
+
+/*
+ * Start over from full power towards all peers
+ */
+static void reset_tx_power(void)
+{
+  uint8_t i;
+
+  for (i = 0; i < RF_RX_PEERS; ++i) {
+    rf_rx_peer_power[i] = RF_TX_POWER_LEVELS - 1;
+  }
+}
+
+
+
+/*
+ * Tune to the channel to listen at, or to the channel being tried while
+ * messages are waiting for an ACK. The radio must be idle.
+ */
+static void tune_hop_channel(void)
+{
+  unsigned char channel;
+
+  if (rf_hop_mode == RF_HOP_OFF) {
+    return;
+  }
+
+  channel = rf_hop_table[(rf_hop_index + (rf_win_count > 0 ? rf_hop_scan : 0)) % RF_CHANNELS];
+  if (channel != rf_channel) {
+    rf_set_channel(channel);
+  }
+}
+
+
+
+/*
+ * Load the synthesizer calibration of the channel, or calibrate and keep
+ * the result. The radio must be idle.
+ */
+static void calibrate(void)
+{
+#if RF_USE_FSCAL_CACHE == 1
+  uint8_t i;
+
+  if (++rf_fscal_age >= RF_FSCAL_MAX_AGE) {
+    rf_fscal_age = 0;
+    rf_fscal_valid = 0;
+  }
+
+  for (i = 0; i < RF_FSCAL_CACHE; ++i) {
+    if ((rf_fscal_valid & (1 << i)) && rf_fscal_chan[i] == rf_channel) {
+      break;
+    }
+  }
+
+  if (i < RF_FSCAL_CACHE) {
+    if (i != rf_fscal_loaded) {
+      WriteSingleReg(FSCAL3, rf_fscal_val[i][0]);
+      WriteSingleReg(FSCAL2, rf_fscal_val[i][1]);
+      WriteSingleReg(FSCAL1, rf_fscal_val[i][2]);
+      rf_fscal_loaded = i;
+    }
+    return;
+  }
+
+  // Let the radio calibrate (about 720 us) on its way to RX or TX instead
+  // of waiting for it here, this may be the interrupt handler. The main
+  // loop keeps the result.
+  if (!rf_fscal_pending) {
+    WriteSingleReg(MCSM0, ReadSingleReg(MCSM0) | RF_MCSM0_FS_AUTOCAL_IDLE);
+    rf_fscal_pending = 1;
+  }
+#endif
+}
+
+
+
+/*
+ * Keep the result of the calibration done by the radio, once it has
+ * reached RX or TX, and turn the automatic calibration off again
+ */
+static void keep_calibration(void)
+{
+#if RF_USE_FSCAL_CACHE == 1
+  uint8_t i;
+  uint8_t state;
+
+  // The registers can't be read while the radio sleeps in WOR
+  if (!rf_fscal_pending || rf_wor_active) {
+    return;
+  }
+
+  state = ReadSingleReg(MARCSTATE) & RF_MARCSTATE_MASK;
+  if (state != RF_MARCSTATE_RX && state != RF_MARCSTATE_TX) {
+    return;
+  }
+
+  WriteSingleReg(MCSM0, ReadSingleReg(MCSM0) & ~RF_MCSM0_FS_AUTOCAL);
+  rf_fscal_pending = 0;
+
+  // Replace the entry of the channel, if it was loaded in the meantime
+  for (i = 0; i < RF_FSCAL_CACHE; ++i) {
+    if ((rf_fscal_valid & (1 << i)) && rf_fscal_chan[i] == rf_channel) {
+      break;
+    }
+  }
+  if (i == RF_FSCAL_CACHE) {
+    i = rf_fscal_next;
+    rf_fscal_next = (i + 1) % RF_FSCAL_CACHE;
+  }
+  rf_fscal_chan[i] = rf_channel;
+  rf_fscal_val[i][0] = ReadSingleReg(FSCAL3);
+  rf_fscal_val[i][1] = ReadSingleReg(FSCAL2);
+  rf_fscal_val[i][2] = ReadSingleReg(FSCAL1);
+  rf_fscal_valid |= 1 << i;
+  rf_fscal_loaded = i;
+#endif
+}
+
+
+
+/*
+ * Write the settings of a data rate profile. The radio must be idle.
+ * The TX power starts again from full power.
+ */
+static void switch_profile(unsigned char profile)
+{
+  rf_profile = profile;
+  rf_profile_next = RF_NO_PROFILE;
+  rf_rate_req = RF_NO_PROFILE;
+  rf_rate_good = 0;
+  rf_tx_power = RF_TX_POWER_LEVELS - 1;
+  reset_tx_power();
+  rf_fscal_valid = 0;
+  write_rf_settings();
+}
+
+
+
+/*
+ * Restart the lease of a faster profile. It runs on a compare channel of
+ * its own, next to the timeouts of the ACKs, backoffs and preambles.
+ */
+static void start_rate_lease(void)
+{
+  if (!rf_use_rate_adapt || rf_profile == RF_RATE_BASE_PROFILE) {
+    timer_lease_clear();
+    return;
+  }
+
+  timer_lease_set(RF_RATE_LEASE_MS);
+}
+
+
+
+/*
+ * Fall back to the base profile when the lease has run out. Waits for
+ * an exchange in progress to end.
+ */
+static void check_rate_lease(void)
+{
+  unsigned char receiving = rf_receiving;
+
+  if (!timer_lease_occurred || rf_transmitting || rf_arq_waiting ||
+      rf_rx_len > 0) {
+    return;
+  }
+
+  timer_lease_clear();
+  if (rf_profile == RF_RATE_BASE_PROFILE) {
+    return;
+  }
+
+  if (receiving) {
+    rf_receive_off();
+  }
+  switch_profile(RF_RATE_BASE_PROFILE);
+  if (receiving) {
+    rf_receive_on();
+  }
+}
+
+
+
+/*
+ * Switch to the profile agreed on in the interrupt handler. Writing the
+ * settings takes too long for the interrupt handler, so it's done here
+ * once the radio isn't busy with a packet.
+ */
+static void apply_profile(void)
+{
+  unsigned char receiving = rf_receiving;
+
+  if (rf_profile_next == RF_NO_PROFILE || rf_transmitting || rf_rx_len > 0) {
+    return;
+  }
+
+  if (receiving) {
+    rf_receive_off();
+  }
+  switch_profile(rf_profile_next);
+  start_rate_lease();
+  if (receiving) {
+    rf_receive_on();
+  }
+}
+
+
+
+/*
+ * Do the work left over from the interrupt handler. Call with interrupts
+ * disabled.
+ */
+static void poll_radio(void)
+{
+  keep_calibration();
+  apply_profile();
+  check_rate_lease();
+}
+
+
+
+/*
+ * Release the first count messages of the window from the queue
+ */
+static void release_window(uint8_t count)
+{
+  uint16_t len = 0;
+  uint8_t i;
+
+  for (i = 0; i < count; ++i) {
+    len += rf_win_len[i];
+  }
+
+  for (i = count; i < rf_win_count; ++i) {
+    rf_win_len[i - count] = rf_win_len[i];
+    rf_win_tries[i - count] = rf_win_tries[i];
+  }
+
+  RfTxQueue_head = queue_index(RfTxQueue_head + len);
+  RfTxQueueLength -= len;
+  if (rf_tx_pkt_count > 0) {
+    rf_tx_pkt_first = (rf_tx_pkt_first + count) % RF_TX_PACKETS;
+    rf_tx_pkt_count -= count;
+  }
+  rf_win_count -= count;
+  rf_win_acked >>= count;
+  rf_tx_seq += count;
+}
+
+
+
+/*
+ * Write at most max_len bytes of the current packet to the TX FIFO.
+ * Bytes are written in two bursts, if they wrap around the end of the queue.
+ */
+static void write_tx_fifo(unsigned char max_len)
+{
+  unsigned char len = rf_tx_left;
+  unsigned char first;
+
+  if (len > max_len) {
+    len = max_len;
+  }
+
+  first = RF_QUEUE_LEN - rf_tx_pos > len ? len : RF_QUEUE_LEN - rf_tx_pos;
+  WriteBurstReg(RF_TXFIFOWR, (unsigned char *)&RfTxQueue[rf_tx_pos], first);
+  WriteBurstReg(RF_TXFIFOWR, (unsigned char *)RfTxQueue, len - first);
+
+  rf_tx_pos = queue_index(rf_tx_pos + len);
+  rf_tx_left -= len;
+  max_len -= len;
+
+  // Padding of a fixed length packet
+  while (rf_tx_left == 0 && rf_tx_pad > 0 && max_len > 0) {
+    WriteSingleReg(RF_TXFIFOWR, 0);
+    --rf_tx_pad;
+    --max_len;
+  }
+
+  // Whole packet in the FIFO, no more refills needed
+  if (rf_tx_left == 0 && rf_tx_pad == 0) {
+    RF1AIE &= ~BIT2;
+  }
+}
+
+
+
+/*
+ * Find the entry of a peer, or take the oldest one. Only for packets
+ * received from the peer.
+ */
+static uint8_t rx_peer(unsigned char src)
+{
+  uint8_t i = find_peer(src);
+
+  if (i < RF_RX_PEERS) {
+    return i;
+  }
+
+  i = rf_rx_peer_next;
+  rf_rx_peer_next = (i + 1) % RF_RX_PEERS;
+  rf_rx_peer_addr[i] = src;
+  rf_rx_peer_seq[i] = 0;
+  rf_rx_peer_len[i] = 0;
+  rf_rx_peer_power[i] = RF_TX_POWER_LEVELS - 1;
+  rf_rx_peer_win &= ~(1 << i);
+
+  return i;
+}
+
+
+
+/*
+ * Return the entry of a peer, or RF_RX_PEERS if it has none. Unused
+ * entries hold the broadcast address, so it never has one.
+ */
+static uint8_t find_peer(unsigned char src)
+{
+  uint8_t i;
+
+  if (src == RF_ADDR_BROADCAST) {
+    return RF_RX_PEERS;
+  }
+
+  for (i = 0; i < RF_RX_PEERS; ++i) {
+    if (rf_rx_peer_addr[i] == src) {
+      return i;
+    }
+  }
+
+  return RF_RX_PEERS;
+}
+
+
+
+/*
+ * Wrap an index running past the end of RfTxQueue back to the start.
+ * Indexes are always less than 2 * RF_QUEUE_LEN, so no division is needed.
+ */
+static uint16_t queue_index(uint16_t i)
+{
+  if (i >= RF_QUEUE_LEN) {
+    i -= RF_QUEUE_LEN;
+  }
+
+  return i;
 }
 
 
@@ -37,13 +37,81 @@
 #include <msp430.h>
 #include <stdint.h>
 
-#define PAYLOAD_LEN        (60)                // Max payload
-#define PACKET_LEN         (PAYLOAD_LEN + 3)   // PACKET_LEN = payload + len + RSSI + LQI
-#define RF_QUEUE_LEN       (PAYLOAD_LEN * 3)   // Space for several messages
+#define RF_HDR_LEN         (4)                 // Link header: destination, source, flags, sequence number
+#define PAYLOAD_LEN        (255 - RF_HDR_LEN)  // Max payload
+#define PACKET_LEN         (PAYLOAD_LEN + RF_HDR_LEN + 3) // PACKET_LEN = payload + header + len + RSSI + LQI
+#define RF_QUEUE_LEN       (PAYLOAD_LEN * 2)   // Space for several messages
+#define RF_ARQ_MAX_WINDOW  (4)                 // Max frames in flight before an ACK is needed
+#define RF_RX_QUEUE_SLOTS  (RF_ARQ_MAX_WINDOW) // Received packets buffered for the main loop
+#define RF_FIFO_LEN        (64)                // Size of the RX and TX FIFOs
+#define RF_TX_FIFO_THR     (33)                // TX FIFO threshold (FIFOTHR = 0x47)
+#define RF_RX_FIFO_THR     (32)                // RX FIFO threshold (FIFOTHR = 0x47)
 #define CRC_OK             (BIT7)              // CRC_OK bit
-#define PATABLE_VAL        (0xC3)              // +10 dBm output
-//#define PATABLE_VAL        (0x51)              // 0 dBm output
+#define RF_FLAG_ACK        (BIT7)              // Link header: frame is an ACK
+#define RF_FLAG_ACK_REQ    (BIT6)              // Link header: sender wants an ACK
+#define RF_FLAG_WINDOW     (BIT5)              // Link header: frame of a sliding window transfer
+#define RF_FLAG_RATE       (BIT4)              // Link header: switch to the profile below after the ACK
+#define RF_FLAG_RELAY      (BIT3)              // Link header: payload starts with a relay header
+#define RF_FLAG_PROFILE    (0x03)              // Link header: data rate profile for RF_FLAG_RATE
+#define RF_ACK_LEN         (3)                 // ACK payload: window bit mask, RSSI, CRC/LQI
+#define RF_ADDR_BROADCAST  (0x00)              // Received by all nodes, never acknowledged
+#define RF_ADDR_GATEWAY    (0x01)              // Default destination
+#define RF_RX_PEERS        (8)                 // Senders tracked for duplicate detection
+#define RF_ARQ_MAX_RETRIES (3)                 // Retransmissions before dropping a message
+#define RF_ARQ_ACK_TIMEOUT_MS (50)             // Timeout for receiving an ACK
+#define RF_CSMA_MIN_BE     (2)                 // Initial backoff exponent
+#define RF_CSMA_MAX_BE     (5)                 // Max backoff exponent
+#define RF_CSMA_SLOT_MS    (2)                 // Backoff slot length
+#define RF_TX_AIRTIME_MS   (60)                // Longest packet at 38.4 kBaud
+// Longest send of a message: every retry with max airtime, the ACK
+// timeout doubled for FEC and the longest backoff
+#define RF_SEND_TIMEOUT_MS ((RF_ARQ_MAX_RETRIES + 1) * \
+                            (RF_TX_AIRTIME_MS + 2 * RF_ARQ_ACK_TIMEOUT_MS + \
+                             (RF_CSMA_SLOT_MS << RF_CSMA_MAX_BE)))
+#define RF_RATE_BASE_PROFILE (RF_PROFILE_1K2) // Profile to fall back to when the link is lost
+#define RF_RATE_MARGIN_DB  (10)                // RSSI margin over the sensitivity to step up
+#define RF_RATE_MAX_LQI    (30)                // Worst LQI to step up
+#define RF_RATE_UP_COUNT   (8)                 // Good ACKs in a row before stepping up
+#define RF_RATE_LEASE_MS   (20000)             // Fall back after this long without traffic
+#define RF_WOR_INTERVAL_MS (100)               // Time between WOR receiver wake ups
+#define RF_WOR_EVENT0      (RF_WOR_INTERVAL_MS * 26000UL / 750) // WOREVT for the interval, WOR_RES = 0
+#define RF_WOR_PREAMBLE_MS (500)               // Long preamble, timeout timer units (ACLK/8)
+#define PATABLE_VAL        (0xC3)              // +10 dBm output, highest TX power level
+#define RF_TX_POWER_LEVELS (5)                 // -30, -12, -6, 0 and +10 dBm
+#define RF_TX_POWER_MARGIN_DB (15)             // RSSI margin over the sensitivity to keep
+#define RF_HOP_DWELL_MS    (2000)              // Time the hop master stays on a channel
+#define RF_FSCAL_MAX_AGE   (256)               // RX and TX starts before calibrating again
+#define RF_FSCAL_TEMP_DELTA (10)               // Temperature change to calibrate again, C
 
+// Length of all packets in the FEC mode, including the length byte and
+// the link header. All nodes of a network must agree on it.
+#ifndef RF_FEC_PKTLEN
+#define RF_FEC_PKTLEN      (48)
+#endif
+#define RF_FEC_PAYLOAD_LEN (RF_FEC_PKTLEN - 1 - RF_HDR_LEN) // Max payload in the FEC mode
+
+// Bytes of each packet kept free for a header added on the way, the 3
+// byte relay header of wireless-uart. All nodes of a network with relays
+// must set it, so that a relay never has to drop a packet it has already
+// acknowledged. Packets queued with rf_relay_msg_to() use the whole
+// payload.
+#ifndef RF_PAYLOAD_RESERVE
+#define RF_PAYLOAD_RESERVE (0)
+#endif
+
+
+// Channels used for hopping, spaced by MDMCFG1/MDMCFG0 (about 200 kHz).
+// All nodes of a network must agree on these. Networks close to each
+// other should use different seeds.
+#ifndef RF_CHANNELS
+#define RF_CHANNELS        (4)                 // 433.92 - 434.52 MHz
+#endif
+#ifndef RF_CHANNEL_FIRST
+#define RF_CHANNEL_FIRST   (0)
+#endif
+#ifndef RF_HOP_SEED
+#define RF_HOP_SEED        (0x2F5A)            // Hop sequence of the network, non-zero
+#endif
 
 #define CC430_STATE_TX                   (0x20)
 #define CC430_STATE_IDLE                 (0x00)
@@ -52,33 +120,65 @@
 #define CC430_FIFO_BYTES_AVAILABLE_MASK  (0x0F)
 #define CC430_STATE_RX                   (0x10)
 #define CC430_STATE_RX_OVERFLOW          (0x60)
+#define CC430_RXBYTES_OVERFLOW           (0x80)
 
-// Buffer for incoming data from RF
-extern volatile unsigned char RfRxBuffer[PACKET_LEN];
-extern volatile unsigned char RfRxBufferLength;
-
-// Queue for messages to be sent out over RF
+// Circular queue for messages to be sent out over RF
 extern volatile unsigned char RfTxQueue[RF_QUEUE_LEN];
-extern volatile unsigned char RfTxQueue_i;
+extern volatile uint16_t RfTxQueue_head;        // Index of the oldest queued byte
+extern volatile uint16_t RfTxQueue_tail;        // Index of the next free byte
+extern volatile uint16_t RfTxQueueLength;       // Amount of queued bytes
 
-// Buffer for message currently being sent out over RF
-extern volatile unsigned char RfTxBuffer[PACKET_LEN];
 extern volatile unsigned char rf_error;
 
 extern volatile unsigned char rf_transmitting;
 extern volatile unsigned char rf_receiving;
+extern volatile unsigned char rf_arq_waiting;
+extern volatile unsigned char rf_backoff;
+extern volatile unsigned char rf_tx_lost;       // Windows given up, wraps around
 
 enum RF_SEND_MSG {
   RF_SEND_MSG_FULL,
   RF_SEND_MSG_FORCE
 };
 
+enum RF_HOP_MODE {
+  RF_HOP_OFF,                                  // Stay on the channel of rf_set_channel()
+  RF_HOP_FOLLOWER,                             // Follow the channel of the master
+  RF_HOP_MASTER                                // Change the channel every RF_HOP_DWELL_MS
+};
+
 void rf_init(void);
+void rf_wake(void);
 void rf_wait_for_idle(void);
 void rf_shutdown(void);
 void rf_receive_on(void);
 void rf_receive_off(void);
-void rf_append_msg(unsigned char *buf, unsigned char len);
+void rf_receive_wor(void);
+uint8_t rf_append_msg(unsigned char *buf, uint16_t len);
+uint8_t rf_append_msg_to(uint8_t addr, unsigned char *buf, uint16_t len);
+uint8_t rf_relay_msg_to(uint8_t addr, unsigned char *buf, uint16_t len);
+uint8_t rf_append_packet_to(uint8_t addr, unsigned char *buf, uint16_t len);
+void rf_set_address(uint8_t addr);
 uint8_t rf_send_next_msg(enum RF_SEND_MSG force);
+void rf_arq_enable(uint8_t window);
+void rf_csma_enable(uint8_t enable);
+void rf_long_preamble(uint8_t enable);
+void rf_fec_enable(uint8_t enable);
+uint8_t rf_max_payload(void);
+void rf_set_profile(uint8_t profile);
+void rf_rate_adapt_enable(uint8_t enable);
+void rf_poll(void);
+void rf_tx_power_control(uint8_t enable);
+void rf_set_channel(uint8_t channel);
+void rf_hop_enable(enum RF_HOP_MODE mode);
+void rf_hop_poll(void);
+void rf_fscal_temperature(int8_t celsius);
+uint8_t rf_receive_pending(void);
+uint8_t rf_receive_source(void);
+uint8_t rf_receive_seq(void);
+uint8_t rf_receive_relayed(void);
+uint8_t rf_receive_packet(unsigned char *buf, uint8_t *rssi, uint8_t *lqi);
+uint8_t rf_receive_peek(unsigned char *buf, uint8_t *rssi, uint8_t *lqi);
+void rf_receive_release(void);
 
 #endif
@@ -0,0 +1,509 @@
+/*
+ * Binary telemetry readings
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#include "telemetry.h"
+#include "utils.h"
+
+static uint8_t put_varint(uint32_t value, unsigned char *buf);
+static uint8_t get_varint(unsigned char *buf, uint8_t len, uint32_t *value);
+static int32_t record_value(unsigned char *rec, uint8_t sign);
+static uint8_t format_value(uint8_t type, int32_t value, unsigned char *str, uint8_t len);
+static uint8_t temp_itoa(int16_t temp, unsigned char *str, uint8_t len);
+
+/*
+ * Start a reading in buf. Returns the length of the reading header, the
+ * records are put after it.
+ */
+uint8_t tlm_begin(unsigned char *buf)
+{
+  buf[0] = TLM_VERSION;
+  buf[1] = 0;
+
+  return TLM_HDR_LEN;
+}
+
+
+
+/*
+ * Write an unsigned value record to buf. Returns the record length, at
+ * most TLM_REC_MAX bytes.
+ */
+uint8_t tlm_put_uint(uint8_t type, uint32_t value, unsigned char *buf)
+{
+  uint8_t len = 0;
+
+  // Zero has no value bytes at all
+  while (value != 0) {
+    buf[1 + len++] = value & 0xff;
+    value >>= 8;
+  }
+  buf[0] = (type << 3) | len;
+
+  return 1 + len;
+}
+
+
+
+/*
+ * Write a signed value record to buf. Returns the record length, at
+ * most TLM_REC_MAX bytes.
+ */
+uint8_t tlm_put_int(uint8_t type, int32_t value, unsigned char *buf)
+{
+  uint8_t len = 0;
+  uint8_t last;
+
+  // Stop once the rest is just the sign extension of the last byte
+  do {
+    last = (value >= -128 && value <= 127);
+    buf[1 + len++] = value & 0xff;
+    value >>= 8;
+  } while (!last);
+  buf[0] = (type << 3) | len;
+
+  return 1 + len;
+}
+
+
+
+/*
+ * Finish a reading of len bytes started with tlm_begin. Returns the
+ * length of the whole reading.
+ */
+uint8_t tlm_end(unsigned char *buf, uint8_t len)
+{
+  buf[1] = len - TLM_HDR_LEN;
+
+  return len;
+}
+
+
+
+/*
+ * Reset a stream, the next reading is a keyframe
+ */
+void tlm_stream_init(tlm_stream_t *stream)
+{
+  stream->seq = 0;
+  stream->keyframe = 0;
+  stream->synced = 0;
+  stream->values = 0;
+}
+
+
+
+/*
+ * Tell the encoder that the readings sent may have been lost, the next
+ * reading is then a keyframe
+ */
+void tlm_stream_lost(tlm_stream_t *stream)
+{
+  stream->synced = 0;
+}
+
+
+
+/*
+ * Start the next reading of a stream in buf. Returns the length of the
+ * reading header, the values are put after it with tlm_stream_put and
+ * the reading is finished with tlm_end.
+ */
+uint8_t tlm_stream_begin(tlm_stream_t *stream, unsigned char *buf)
+{
+  stream->keyframe = (stream->seq % TLM_KEYFRAME_INTERVAL == 0 ||
+                      !stream->synced);
+  stream->synced = 1;
+  stream->values = 0;
+
+  buf[0] = stream->keyframe ? TLM_KEYFRAME : TLM_DELTA;
+  buf[1] = 0;
+  buf[2] = stream->seq++;
+
+  return TLM_STREAM_HDR_LEN;
+}
+
+
+
+/*
+ * Put a value to a reading started with tlm_stream_begin. All readings
+ * of a stream must have the same values in the same order. Returns the
+ * number of bytes written, at most TLM_REC_MAX.
+ */
+uint8_t tlm_stream_put(tlm_stream_t *stream, uint8_t type, int32_t value, unsigned char *buf)
+{
+  uint8_t i = stream->values;
+  uint8_t len;
+
+  if (i == TLM_VALUES) {
+    return 0;
+  }
+
+  if (stream->keyframe) {
+    len = tlm_put_int(type, value, buf);
+  } else {
+    uint32_t delta = (uint32_t)value - (uint32_t)stream->last[i];
+
+    // Zigzag, so that small negative changes are small too
+    len = put_varint((delta << 1) ^ (0 - (delta >> 31)), buf);
+  }
+
+  stream->type[i] = type;
+  stream->last[i] = value;
+  ++stream->values;
+
+  return len;
+}
+
+
+
+/*
+ * Check that buf starts with a complete reading of a known version.
+ * Returns the length of the reading, or 0 if it isn't one.
+ */
+uint8_t tlm_reading_len(unsigned char *buf, uint8_t len)
+{
+  uint8_t pos;
+  uint8_t end;
+  uint8_t values = 0;
+
+  if (len < TLM_HDR_LEN || buf[1] > len - TLM_HDR_LEN) {
+    return 0;
+  }
+  end = TLM_HDR_LEN + buf[1];
+
+  if (buf[0] == TLM_VERSION) {
+    pos = TLM_HDR_LEN;
+  } else if (buf[0] == TLM_KEYFRAME || buf[0] == TLM_DELTA) {
+    pos = TLM_STREAM_HDR_LEN;
+  } else {
+    return 0;
+  }
+  if (pos > end) {
+    return 0;
+  }
+
+  // The records or the varints must fill the reading exactly
+  while (pos < end) {
+    uint8_t n;
+
+    if (buf[0] == TLM_DELTA) {
+      uint32_t value;
+
+      n = get_varint(&buf[pos], end - pos, &value);
+      if (n == 0) {
+        return 0;
+      }
+    } else {
+      n = 1 + (buf[pos] & 0x07);
+      if (n > TLM_REC_MAX || n > end - pos) {
+        return 0;
+      }
+    }
+
+    if (++values > TLM_VALUES) {
+      return 0;
+    }
+    pos += n;
+  }
+
+  return end;
+}
+
+
+
+/*
+ * Format a reading checked with tlm_reading_len as text, e.g.
+ * "C:12 B:2345 T:+23.50". The readings of a stream are decoded with the
+ * stream of their sender. After a lost reading the deltas can't be
+ * decoded until the next keyframe. Returns the length of the text, or 0
+ * if the reading can't be decoded or str_len isn't enough.
+ */
+uint8_t tlm_decode(tlm_stream_t *stream, unsigned char *buf, unsigned char *str, uint8_t str_len)
+{
+  uint8_t type[TLM_VALUES];
+  int32_t value[TLM_VALUES];
+  uint8_t values = 0;
+  uint8_t end = TLM_HDR_LEN + buf[1];
+  uint8_t len = 0;
+  uint8_t pos;
+  uint8_t i;
+
+  if (buf[0] == TLM_DELTA) {
+    if (!stream->synced || buf[2] != stream->seq) {
+      stream->synced = 0;
+      return 0;
+    }
+
+    pos = TLM_STREAM_HDR_LEN;
+    while (pos < end && values < stream->values) {
+      uint32_t zigzag;
+
+      pos += get_varint(&buf[pos], end - pos, &zigzag);
+      type[values] = stream->type[values];
+      value[values] = (uint32_t)stream->last[values] +
+        ((zigzag >> 1) ^ (0 - (zigzag & 1)));
+      ++values;
+    }
+
+    // Not the values of the keyframe
+    if (pos < end || values < stream->values) {
+      stream->synced = 0;
+      return 0;
+    }
+  } else {
+    pos = (buf[0] == TLM_VERSION) ? TLM_HDR_LEN : TLM_STREAM_HDR_LEN;
+    while (pos < end) {
+      type[values] = buf[pos] >> 3;
+      // Stream values are signed, in plain readings only the temperature
+      value[values] = record_value(&buf[pos], buf[0] == TLM_KEYFRAME ||
+                                   type[values] == TLM_TEMPERATURE);
+      pos += 1 + (buf[pos] & 0x07);
+      ++values;
+    }
+
+    if (buf[0] == TLM_KEYFRAME) {
+      stream->synced = 1;
+      stream->values = values;
+    }
+  }
+
+  // Following readings are relative to this one
+  if (buf[0] != TLM_VERSION) {
+    for (i = 0; i < values; ++i) {
+      stream->type[i] = type[i];
+      stream->last[i] = value[i];
+    }
+    stream->seq = buf[2] + 1;
+  }
+
+  for (i = 0; i < values; ++i) {
+    uint8_t n;
+
+    if (i > 0) {
+      if (len == str_len) {
+        return 0;
+      }
+      str[len++] = ' ';
+    }
+
+    n = format_value(type[i], value[i], &str[len], str_len - len);
+    if (n == 0) {
+      return 0;
+    }
+    len += n;
+  }
+
+  return len;
+}
+
+
+
+/*
+ * Write value as a varint, 7 bits per byte starting from the lowest,
+ * the high bit set in all but the last byte. Returns the number of
+ * bytes written, at most TLM_VARINT_MAX.
+ */
+static uint8_t put_varint(uint32_t value, unsigned char *buf)
+{
+  uint8_t len = 0;
+
+  while (value >= 0x80) {
+    buf[len++] = (value & 0x7f) | 0x80;
+    value >>= 7;
+  }
+  buf[len++] = value;
+
+  return len;
+}
+
+
+
+/*
+ * Read a varint from buf of len bytes. Returns the number of bytes
+ * read, or 0 if the varint doesn't end within len or TLM_VARINT_MAX.
+ */
+static uint8_t get_varint(unsigned char *buf, uint8_t len, uint32_t *value)
+{
+  uint8_t i;
+
+  *value = 0;
+  for (i = 0; i < len && i < TLM_VARINT_MAX; ++i) {
+    *value |= (uint32_t)(buf[i] & 0x7f) << (7 * i);
+    if ((buf[i] & 0x80) == 0) {
+      return i + 1;
+    }
+  }
+
+  return 0;
+}
+
+
+
+/*
+ * Value of the record in rec, sign extended if sign is set
+ */
+static int32_t record_value(unsigned char *rec, uint8_t sign)
+{
+  uint8_t len = rec[0] & 0x07;
+  uint32_t value = 0;
+  uint8_t i;
+
+  if (sign && len > 0 && (rec[len] & 0x80)) {
+    value = 0xffffffff;
+  }
+
+  for (i = len; i > 0; --i) {
+    value = (value << 8) | rec[i];
+  }
+
+  return value;
+}
+
+
+
+/*
+ * Format a value with the name of its type, e.g. "B:2345". Returns the
+ * length of the text, or 0 if len isn't enough.
+ */
+static uint8_t format_value(uint8_t type, int32_t value, unsigned char *str, uint8_t len)
+{
+  uint8_t str_len = 0;
+  uint8_t n;
+
+  // Space for the longest name
+  if (len < 5) {
+    return 0;
+  }
+
+  switch (type) {
+  case TLM_COUNTER:
+    str[str_len++] = 'C';
+    break;
+  case TLM_BATTERY:
+    str[str_len++] = 'B';
+    break;
+  case TLM_TEMPERATURE:
+    str[str_len++] = 'T';
+    break;
+  case TLM_BLINKS:
+    str[str_len++] = 'L';
+    break;
+  default:
+    if (type >= TLM_ADC && type < TLM_ADC + 8) {
+      str[str_len++] = 'A';
+      str[str_len++] = '0' + type - TLM_ADC;
+    } else {
+      // Unknown type from a newer node, pass the raw value on
+      str[str_len++] = 'X';
+      str_len += sc_itoa(type, &str[str_len], 3);
+    }
+    break;
+  }
+  str[str_len++] = ':';
+
+  if (type == TLM_TEMPERATURE) {
+    n = temp_itoa(value, &str[str_len], len - str_len);
+  } else {
+    n = sc_itoa(value, &str[str_len], len - str_len);
+  }
+  if (n == 0) {
+    return 0;
+  }
+
+  return str_len + n;
+}
+
+
+
+/*
+ * Format a TMP275 temperature, e.g. "+23.50". Returns the length of the
+ * text, or 0 if len isn't enough.
+ */
+static uint8_t temp_itoa(int16_t temp, unsigned char *str, uint8_t len)
+{
+  uint8_t str_len = 0;
+  uint16_t temp_int;
+  uint32_t temp_frac;
+  uint8_t n;
+  char sign = 1;
+
+  // Sign, at least one digit, '.', two decimals and '\0'
+  if (len < 7) {
+    return 0;
+  }
+
+  /* Grab the sign and convert to positive
+   * Negative integer math is... interesting so we take the risk of
+   * asymmetry and convert to positive. This might incur heavy error
+   * for some values, but is verified to work correctly with a fixed
+   * dataset in the range of 127.93...-55.00 (from datasheets).
+   */
+  if (temp < 0) {
+    sign = -1;
+    temp *= -1;
+  }
+
+  /* We always mark the sign to make parsing easier */
+  str[str_len++] = (sign == 1) ? '+' : '-';
+
+  /* Integer part */
+  temp_int = temp >> 8;
+
+  n = sc_itoa(temp_int, &str[str_len], len - str_len - 4);
+  if (n == 0) {
+    return 0;
+  }
+  str_len += n;
+
+  /* Decimal part is in the low 8 bits, but only top 4 bits are used.
+   * One step is roughly 0.06253 degrees Celsius, but no floats here!
+   * So we multiply by 6253 and divide by 1000 to catch the first two
+   * decimal places
+   */
+  temp_frac = (((((uint32_t)temp) & 0xf0) >> 4) * 6253) / 1000;
+  str[str_len++] = '.';
+
+  /* Add leading zero, if needed */
+  if (temp_frac < 10) {
+    str[str_len++] = '0';
+  }
+
+  str_len += sc_itoa(temp_frac, &str[str_len], len - str_len);
+
+  return str_len;
+}
+
+
+
+/* Emacs indentatation information
+   Local Variables:
+   indent-tabs-mode:nil
+   tab-width:2
+   c-basic-offset:2
+   End:
+*/
@@ -0,0 +1,96 @@
+/*
+ * Binary telemetry readings
+ *
+ * Copyright 2014 Tuomas Kulve, <tuomas.kulve@snowcap.fi>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+#ifndef RB_TELEMETRY_H
+#define RB_TELEMETRY_H
+
+#include "common.h"
+
+#include <stdint.h>
+
+/*
+ * A reading is a version byte, the length of the records and the
+ * records. A record is one byte with the type in the high 5 bits and
+ * the value length in the low 3 bits, followed by the value in little
+ * endian with the leading zero (or sign) bytes left out. Bit 7 of the
+ * version byte is always set, so a reading can't be mistaken for ASCII.
+ *
+ * A stream of readings from a node has a sequence number after the
+ * length. Every TLM_KEYFRAME_INTERVAL readings is a keyframe with the
+ * values as records, the readings in between have only the change of
+ * each value since the previous reading, in the order of the keyframe,
+ * as zigzag varints. After a lost reading the decoder waits for the next
+ * keyframe.
+ */
+#define TLM_VERSION        0x81
+#define TLM_KEYFRAME       0x82
+#define TLM_DELTA          0x83
+#define TLM_HDR_LEN        2
+#define TLM_STREAM_HDR_LEN 3
+#define TLM_REC_MAX        5      // Record with a 32 bit value
+#define TLM_VARINT_MAX     5      // Varint of a 32 bit value
+#define TLM_VALUES         8      // Max values in a reading
+#define TLM_LINE_LEN       80     // Text of one decoded reading
+
+#ifndef TLM_KEYFRAME_INTERVAL
+#define TLM_KEYFRAME_INTERVAL 16
+#endif
+
+enum TLM_TYPE {
+  TLM_COUNTER     = 1,            // Readings sent by the node
+  TLM_BATTERY     = 2,            // Battery voltage, raw ADC
+  TLM_TEMPERATURE = 3,            // TMP275, 1/256 degrees Celsius
+  TLM_BLINKS      = 4,            // LED blinks counted by the comparator
+  TLM_ADC         = 8,            // Raw ADC channels 0-7, TLM_ADC + channel
+};
+
+// State of a stream, in the node sending it and in the receiver
+typedef struct tlm_stream_t {
+  uint8_t seq;                    // Sequence number of the next reading
+  uint8_t keyframe;               // The reading is a keyframe
+  uint8_t synced;                 // No readings lost since the keyframe
+  uint8_t values;                 // Values in the reading
+  uint8_t type[TLM_VALUES];
+  int32_t last[TLM_VALUES];       // Values of the previous reading
+} tlm_stream_t;
+
+uint8_t tlm_begin(unsigned char *buf);
+uint8_t tlm_put_uint(uint8_t type, uint32_t value, unsigned char *buf);
+uint8_t tlm_put_int(uint8_t type, int32_t value, unsigned char *buf);
+uint8_t tlm_end(unsigned char *buf, uint8_t len);
+
+void tlm_stream_init(tlm_stream_t *stream);
+void tlm_stream_lost(tlm_stream_t *stream);
+uint8_t tlm_stream_begin(tlm_stream_t *stream, unsigned char *buf);
+uint8_t tlm_stream_put(tlm_stream_t *stream, uint8_t type, int32_t value, unsigned char *buf);
+
+uint8_t tlm_reading_len(unsigned char *buf, uint8_t len);
+uint8_t tlm_decode(tlm_stream_t *stream, unsigned char *buf, unsigned char *str, uint8_t str_len);
+
+#endif
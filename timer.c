@@ -31,6 +31,15 @@
 
 static volatile uint16_t timer_repeats = 0;
 volatile uint8_t timer_occurred = 0;
+volatile uint8_t timer_timeout_occurred = 0;
+volatile uint8_t timer_interval_count = 0;
+volatile uint8_t timer_poll_occurred = 0;
+volatile uint8_t timer_lease_occurred = 0;
+static uint16_t timer_interval = 0;
+static uint16_t timer_poll = 0;
+
+static uint16_t timer_timeout_now(void);
+static void timer_timeout_stop(void);
 
 /*
  * Timeout, repeat timer_repeats times, then wake up from sleep
@@ -89,6 +98,204 @@ void timer_clear(void)
 
 
 
+/*
+ * Timeout on the second timer, used by the radio independently of the
+ * sleep timer
+ */
+__attribute__((interrupt(TIMER0_A0_VECTOR)))
+void TIMER0_A0_ISR(void)
+{
+  timer_timeout_clear();
+  timer_timeout_occurred = 1;
+#if SC_USE_SLEEP == 1
+  // Exit from lower power mode
+  __bic_status_register_on_exit(LPM4_bits);
+#endif
+}
+
+
+
+/*
+ * Interval on the second timer, counts the intervals passed since the
+ * count was last cleared
+ */
+__attribute__((interrupt(TIMER0_A1_VECTOR)))
+void TIMER0_A1_ISR(void)
+{
+  switch(__even_in_range(TA0IV, 14)) {
+  case  2:                                  // CCR1
+    TA0CCR1 += timer_interval;
+    if (timer_interval_count < 0xFF) {
+      ++timer_interval_count;
+    }
+#if SC_USE_SLEEP == 1
+    // Exit from lower power mode
+    __bic_status_register_on_exit(LPM4_bits);
+#endif
+    break;
+  case  4:                                  // CCR2
+    TA0CCR2 += timer_poll;
+    timer_poll_occurred = 1;
+#if SC_USE_SLEEP == 1
+    // Exit from lower power mode
+    __bic_status_register_on_exit(LPM4_bits);
+#endif
+    break;
+  case  6:                                  // CCR3
+    timer_lease_clear();
+    timer_lease_occurred = 1;
+#if SC_USE_SLEEP == 1
+    // Exit from lower power mode
+    __bic_status_register_on_exit(LPM4_bits);
+#endif
+    break;
+  default:
+    break;
+  }
+}
+
+
+
+/*
+ * Set the second timer to raise an interrupt after ms milliseconds. The
+ * timer runs continuously so that the timeout and the interval can share
+ * it.
+ */
+void timer_timeout_set(uint16_t ms)
+{
+  timer_timeout_occurred = 0;
+  TA0CTL = TASSEL_1 + MC_2 + ID_3;          // ACLK/8, continuous mode
+  TA0CCR0  = timer_timeout_now() + ms;      // ms milliseconds
+  TA0CCTL0 = CCIE;                          // CCR0 interrupt enabled
+}
+
+
+
+/*
+ * Stop the timeout on the second timer
+ */
+void timer_timeout_clear(void)
+{
+  timer_timeout_occurred = 0;
+  TA0CCTL0 = 0;                             // CCR0 interrupt disabled
+  timer_timeout_stop();
+}
+
+
+
+/*
+ * Raise an interrupt every ms milliseconds on the second timer, see
+ * timer_interval_count
+ */
+void timer_interval_set(uint16_t ms)
+{
+  timer_interval = ms;
+  timer_interval_count = 0;
+  TA0CTL = TASSEL_1 + MC_2 + ID_3;          // ACLK/8, continuous mode
+  TA0CCR1  = timer_timeout_now() + ms;      // ms milliseconds
+  TA0CCTL1 = CCIE;                          // CCR1 interrupt enabled
+}
+
+
+
+/*
+ * Stop the interval on the second timer
+ */
+void timer_interval_clear(void)
+{
+  timer_interval_count = 0;
+  TA0CCTL1 = 0;                             // CCR1 interrupt disabled
+  timer_timeout_stop();
+}
+
+
+
+/*
+ * Wake up every ms milliseconds on the second timer, see
+ * timer_poll_occurred. Used by the UART to notice an idle line while
+ * the DMA is receiving.
+ */
+void timer_poll_set(uint16_t ms)
+{
+  timer_poll = ms;
+  timer_poll_occurred = 0;
+  TA0CTL = TASSEL_1 + MC_2 + ID_3;          // ACLK/8, continuous mode
+  TA0CCR2  = timer_timeout_now() + ms;      // ms milliseconds
+  TA0CCTL2 = CCIE;                          // CCR2 interrupt enabled
+}
+
+
+
+/*
+ * Stop the poll on the second timer
+ */
+void timer_poll_clear(void)
+{
+  timer_poll_occurred = 0;
+  TA0CCTL2 = 0;                             // CCR2 interrupt disabled
+  timer_timeout_stop();
+}
+
+
+
+/*
+ * Raise timer_lease_occurred after ms milliseconds on the second timer.
+ * Used by the radio for the lease of a faster data rate, which runs
+ * alongside the timeout.
+ */
+void timer_lease_set(uint16_t ms)
+{
+  timer_lease_occurred = 0;
+  TA0CTL = TASSEL_1 + MC_2 + ID_3;          // ACLK/8, continuous mode
+  TA0CCR3  = timer_timeout_now() + ms;      // ms milliseconds
+  TA0CCTL3 = CCIE;                          // CCR3 interrupt enabled
+}
+
+
+
+/*
+ * Stop the lease on the second timer
+ */
+void timer_lease_clear(void)
+{
+  timer_lease_occurred = 0;
+  TA0CCTL3 = 0;                             // CCR3 interrupt disabled
+  timer_timeout_stop();
+}
+
+
+
+/*
+ * Read the counter of the second timer. ACLK is asynchronous to MCLK, so
+ * read until two reads agree.
+ */
+static uint16_t timer_timeout_now(void)
+{
+  uint16_t now;
+
+  do {
+    now = TA0R;
+  } while (now != TA0R);
+
+  return now;
+}
+
+
+
+/*
+ * Stop the second timer when none of the timeout, the interval, the
+ * poll and the lease uses it
+ */
+static void timer_timeout_stop(void)
+{
+  if (!(TA0CCTL0 & CCIE) && !(TA0CCTL1 & CCIE) && !(TA0CCTL2 & CCIE) &&
+      !(TA0CCTL3 & CCIE)) {
+    TA0CTL = TACLR;
+  }
+}
+
+
+
 /*
  * Block in low power mode for ms milliseconds
  */
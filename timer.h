@@ -35,10 +35,22 @@
 #include <stdint.h>
 
 extern volatile uint8_t timer_occurred;
+extern volatile uint8_t timer_timeout_occurred;
+extern volatile uint8_t timer_interval_count;
+extern volatile uint8_t timer_poll_occurred;
+extern volatile uint8_t timer_lease_occurred;
 
 void timer_sleep_ms(uint16_t ms, uint32_t mode);
 void timer_sleep_min(uint16_t min, uint32_t mode);
 void timer_set(int ms);
 void timer_clear(void);
+void timer_timeout_set(uint16_t ms);
+void timer_timeout_clear(void);
+void timer_interval_set(uint16_t ms);
+void timer_interval_clear(void);
+void timer_poll_set(uint16_t ms);
+void timer_poll_clear(void);
+void timer_lease_set(uint16_t ms);
+void timer_lease_clear(void);
 
 #endif
@@ -27,15 +27,18 @@
  */
 
 #include "uart.h"
-
-// Buffer for incoming data from UART
-volatile unsigned char UartRxBuffer[UART_BUF_LEN];
-volatile unsigned char UartRxBuffer_i = 0;
-
-// Buffer for outoing data over UART
-volatile unsigned char UartTxBuffer[UART_BUF_LEN];
-volatile unsigned char UartTxBuffer_i = 0;
-volatile unsigned char UartTxBufferLength = 0;
+#include "clock.h"
+#include "timer.h"
+
+// Ring buffer for incoming data from UART
+static volatile unsigned char UartRxBuffer[UART_BUF_LEN];
+static volatile uint16_t UartRxBuffer_head = 0;
+static volatile uint16_t UartRxBuffer_tail = 0;
+
+// Ring buffer for outoing data over UART
+static volatile unsigned char UartTxBuffer[UART_BUF_LEN];
+static volatile uint16_t UartTxBuffer_head = 0;
+static volatile uint16_t UartTxBuffer_tail = 0;   // The byte being sent
 volatile unsigned char uart_rx_timeout = 0;
 
 typedef enum uart_state_t {
@@ -45,20 +48,58 @@ typedef enum uart_state_t {
 
 static uart_state_t uart_state = UART_STATE_IDLE;
 
+#if UART_USE_FLOW_CTRL == 1
+static volatile uint8_t uart_tx_stopped = 0;    // Waiting for CTS
+#endif
+
+#if UART_USE_DMA == 1
+static volatile uint16_t uart_rx_dma_len = 0;   // RX block length, 0 when stopped
+static uint16_t uart_rx_idle_head = 0;          // Ring head at the previous poll
+static volatile uint16_t uart_tx_dma_len = 0;   // TX block length
+#endif
+
 static void handle_uart_rx_byte(void);
+static void uart_set_baud(uint32_t baud);
+static uint16_t uart_rx_head(void);
+static uint16_t uart_rx_free(void);
+#if UART_USE_DMA == 1
+static uint16_t uart_rx_dma_count(void);
+static void uart_rx_dma_start(void);
+static void uart_rx_dma_stop(uint16_t count);
+static void uart_tx_dma_start(void);
+#endif
+#if UART_USE_FLOW_CTRL == 1
+static void uart_rts_update(void);
+static void uart_cts_changed(void);
+#endif
 
 /*
- * Map P1.5 & P1.6 to Uart TX and RX and initialise Uart as 115200 8N1
- * with interrupts enabled
+ * Map P1.5 & P1.6 to Uart TX and RX and initialise Uart as 8N1 at the
+ * given baud rate with interrupts enabled. Call after clock_init().
  */
-void uart_init(void)
+void uart_init(uint32_t baud)
 {
-  UartTxBuffer_i = 0;
-  UartTxBufferLength = 0;
+  UartTxBuffer_head = 0;
+  UartTxBuffer_tail = 0;
   uart_rx_timeout = 0;
   uart_state = UART_STATE_IDLE;
 
-  UartRxBuffer_i = 0;
+  UartRxBuffer_head = 0;
+  UartRxBuffer_tail = 0;
+
+#if UART_USE_FLOW_CTRL == 1
+  uart_tx_stopped = 0;
+
+  UART_RTS_POUT &= ~UART_RTS_BIT;           // RTS low, ready to receive
+  UART_RTS_PDIR |= UART_RTS_BIT;
+
+  UART_CTS_PDIR &= ~UART_CTS_BIT;           // CTS input, pulled low when not connected
+  UART_CTS_POUT &= ~UART_CTS_BIT;
+  UART_CTS_PREN |= UART_CTS_BIT;
+  UART_CTS_PIES &= ~UART_CTS_BIT;           // Interrupt on the rising edge
+  UART_CTS_PIFG &= ~UART_CTS_BIT;
+  UART_CTS_PIE |= UART_CTS_BIT;
+#endif
 
   PMAPPWD = 0x02D52;                        // Get write-access to port mapping regs
   P1MAP5 = PM_UCA0RXD;                      // Map UCA0RXD output to P1.6
@@ -68,14 +109,26 @@ void uart_init(void)
   P1DIR |= BIT6;                            // Set P1.6 as TX output
   P1SEL |= BIT5 + BIT6;                     // Select P1.5 & P1.6 to UART function
 
+#if UART_USE_DMA == 1
+  uart_rx_dma_len = 0;
+  uart_tx_dma_len = 0;
+
+  DMACTL0 = DMA0TSEL_16 + DMA1TSEL_17;      // UCA0RXIFG and UCA0TXIFG triggers
+  DMACTL4 = DMARMWDIS;                      // Let read-modify-writes finish first
+  DMA0CTL = DMADT_0 + DMADSTINCR_3 + DMADSTBYTE + DMASRCBYTE + DMAIE; // RXBUF to ring
+  DMA0SA = (uintptr_t)&UCA0RXBUF;
+  DMA1CTL = DMADT_0 + DMASRCINCR_3 + DMADSTBYTE + DMASRCBYTE + DMAIE; // Buffer to TXBUF
+  DMA1DA = (uintptr_t)&UCA0TXBUF;
+#endif
+
   UCA0CTL1 |= UCSWRST;                      // **Put state machine in reset**
   UCA0CTL1 |= UCSSEL_2;                     // SMCLK
-  UCA0BR0 = 9;                              // 1MHz 115200 (see User's Guide)
-  UCA0BR1 = 0;                              // 1MHz 115200
-  UCA0MCTL |= UCBRS_1 + UCBRF_0;            // Modulation UCBRSx=1, UCBRFx=0
+  uart_set_baud(baud);
   UCA0CTL1 &= ~UCSWRST;                     // **Initialize USCI state machine**
   UCA0IE |= UCRXIE;                         // Enable USCI_A0 RX interrupt
+#if UART_USE_DMA == 0
   UCA0IE |= UCTXIE;                         // Enable USCI_A0 TX interrupt
+#endif
 }
 
 
@@ -91,26 +144,60 @@ void USCI_A0_ISR(void)
   case 0: break;                            // Vector 0 - no interrupt
   case 2:                                   // Vector 2 - RXIFG
     handle_uart_rx_byte();
+#if UART_USE_DMA == 1
+    // Let the DMA receive the rest of the burst
+    uart_rx_dma_start();
+#endif
 #if SC_USE_SLEEP == 1
     // Exit active
     __bic_status_register_on_exit(LPM3_bits);
 #endif
     break;
   case 4:                                   // Vector 4 - TXIFG
-    if (UartTxBufferLength == 0) {          // Spurious interrupt (or a workaround for a bug)?
+#if UART_USE_DMA == 1
+    // TXBUF is empty, hand the rest of the buffer to the DMA
+    UCA0IE &= ~UCTXIE;
+#if UART_USE_FLOW_CTRL == 1
+    if (UART_CTS_PIN & UART_CTS_BIT) {      // Wait for CTS
+      uart_tx_stopped = 1;
+      UCA0IFG |= UCTXIFG;                   // Reading UCA0IV cleared it
+      return;
+    }
+#endif
+    if (UartTxBuffer_tail == UartTxBuffer_head) { // Spurious interrupt?
+      UCA0IFG |= UCTXIFG;                   // Reading UCA0IV cleared it
+      return;
+    }
+    uart_tx_dma_start();
+#else
+    if (UartTxBuffer_tail == UartTxBuffer_head) { // Spurious interrupt (or a workaround for a bug)?
       return;
     }
 
-    if (++UartTxBuffer_i == UartTxBufferLength) { // All data sent?
-      UartTxBuffer_i = 0;                   // Clear the Uart TX buffers
-      UartTxBufferLength = 0;
+    if (++UartTxBuffer_tail == UART_BUF_LEN) {
+      UartTxBuffer_tail = 0;
+    }
+    if (UartTxBuffer_tail == UartTxBuffer_head) { // All data sent?
       uart_state = UART_STATE_IDLE;
+#if SC_USE_SLEEP == 1
+      // Exit active, there's space for more data
+      __bic_status_register_on_exit(LPM3_bits);
+#endif
       return;
     }
 
+#if UART_USE_FLOW_CTRL == 1
+    if (UART_CTS_PIN & UART_CTS_BIT) {      // Wait for CTS, TXBUF stays empty
+      UCA0IE &= ~UCTXIE;
+      uart_tx_stopped = 1;
+      return;
+    }
+#endif
+
     // More data to be sent to Uart
     //while (!(UCA0IFG&UCTXIFG));             // USCI_A0 TX buffer ready? (should be always in here??)
-    UCA0TXBUF = UartTxBuffer[UartTxBuffer_i]; // Send a byte
+    UCA0TXBUF = UartTxBuffer[UartTxBuffer_tail]; // Send a byte
+#endif
 
     break;
   default: break;
@@ -119,27 +206,102 @@ void USCI_A0_ISR(void)
 
 
 
+#if UART_USE_FLOW_CTRL == 1
+/*
+ * CTS changed
+ */
+__attribute__((interrupt(PORT2_VECTOR)))
+void PORT2_ISR(void)
+{
+  if (UART_CTS_PIFG & UART_CTS_BIT) {
+    UART_CTS_PIFG &= ~UART_CTS_BIT;
+    uart_cts_changed();
+  }
+}
+#endif
+
+
+
+#if UART_USE_DMA == 1
+/*
+ * DMA block done: the RX threshold was reached or a TX block was sent
+ */
+__attribute__((interrupt(DMA_VECTOR)))
+void DMA_ISR(void)
+{
+  switch(__even_in_range(DMAIV, 16)) {
+  case 2:                                   // DMA0IFG - RX threshold
+    if (uart_rx_dma_len == 0) {             // Already stopped by uart_rx_poll()
+      return;
+    }
+    uart_rx_dma_stop(uart_rx_dma_len);
+    break;
+  case 4:                                   // DMA1IFG - TX block sent
+    UartTxBuffer_tail += uart_tx_dma_len;
+    if (UartTxBuffer_tail >= UART_BUF_LEN) {
+      UartTxBuffer_tail -= UART_BUF_LEN;
+    }
+    uart_tx_dma_len = 0;
+    if (UartTxBuffer_tail != UartTxBuffer_head) {
+      // More data after the end of the ring, or appended meanwhile.
+      // Continue when TXBUF is empty.
+      UCA0IE |= UCTXIE;
+      return;
+    }
+    uart_state = UART_STATE_IDLE;
+    break;
+  default:
+    return;
+  }
+
+#if SC_USE_SLEEP == 1
+  // Exit active, there's data to pass on or space for more
+  __bic_status_register_on_exit(LPM3_bits);
+#endif
+}
+#endif
+
+
+
+/*
+ * Return the amount of free space in the UART TX buffer
+ */
+uint16_t uart_tx_free(void)
+{
+  // One byte is always kept free to tell a full buffer from an empty one
+  uint16_t free = UartTxBuffer_tail + UART_BUF_LEN - UartTxBuffer_head - 1;
+
+  return free >= UART_BUF_LEN ? free - UART_BUF_LEN : free;
+}
+
+
+
 /*
  * Append new message to transmit buffer
  */
 uint8_t uart_tx_append_msg(unsigned char *buf, unsigned char len)
 {
   int i;
+  uint16_t head;
 
   // Disable interrupts to make sure UartTxBuffer state isn't modified in the middle
   __bic_status_register(GIE);
 
   // Check that there's enough space
-  if (UartTxBufferLength + len >= UART_BUF_LEN) {
+  if (len > uart_tx_free()) {
     // Enable interrupts
     __bis_status_register(GIE);
     return 0;
   }
 
+  head = UartTxBuffer_head;
   for (i = 0; i < len; ++i) {
-    UartTxBuffer[UartTxBufferLength + i] = buf[i];
+    UartTxBuffer[head] = buf[i];
+    if (++head == UART_BUF_LEN) {
+      head = 0;
+    }
   }
-  UartTxBufferLength += i;
+  UartTxBuffer_head = head;
 
   // Enable interrupts
   __bis_status_register(GIE);
@@ -156,9 +318,24 @@ void uart_send_next_msg(void)
    // Disable interrupts to make sure UartTxBuffer state isn't modified in the middle
   __bic_status_register(GIE);
 
-  if (UartTxBufferLength > 0 && uart_state != UART_STATE_TX) {
+  if (UartTxBuffer_head != UartTxBuffer_tail && uart_state != UART_STATE_TX) {
     uart_state = UART_STATE_TX;
-    UCA0TXBUF = UartTxBuffer[UartTxBuffer_i]; // Send first byte
+#if UART_USE_FLOW_CTRL == 1
+    if (UART_CTS_PIN & UART_CTS_BIT) {      // Start when CTS goes low
+      uart_tx_stopped = 1;
+#if UART_USE_DMA == 0
+      UCA0IE &= ~UCTXIE;
+#endif
+      // Enable interrupts
+      __bis_status_register(GIE);
+      return;
+    }
+#endif
+#if UART_USE_DMA == 1
+    UCA0IE |= UCTXIE;                       // Start the DMA once TXBUF is empty
+#else
+    UCA0TXBUF = UartTxBuffer[UartTxBuffer_tail]; // Send first byte
+#endif
   }
    // Enable interrupts
   __bis_status_register(GIE);
@@ -166,6 +343,143 @@ void uart_send_next_msg(void)
 
 
 
+/*
+ * Return the number of bytes received from UART and not yet consumed
+ */
+uint16_t uart_rx_pending(void)
+{
+  uint16_t head;
+
+  // Disable interrupts to make sure the DMA state isn't modified in the middle
+  __bic_status_register(GIE);
+  head = uart_rx_head();
+  // Enable interrupts
+  __bis_status_register(GIE);
+
+  head += UART_BUF_LEN - UartRxBuffer_tail;
+  return head >= UART_BUF_LEN ? head - UART_BUF_LEN : head;
+}
+
+
+
+/*
+ * Return the oldest received data that is contiguous in the ring
+ * buffer, and its length in len. The data stays in the buffer until
+ * uart_rx_consume() is called.
+ */
+unsigned char *uart_rx_data(uint16_t *len)
+{
+  uint16_t head;
+  uint16_t tail = UartRxBuffer_tail;
+
+  // Disable interrupts to make sure the DMA state isn't modified in the middle
+  __bic_status_register(GIE);
+  head = uart_rx_head();
+  // Enable interrupts
+  __bis_status_register(GIE);
+
+  if (head >= tail) {
+    *len = head - tail;
+  } else {
+    *len = UART_BUF_LEN - tail;             // Up to the end of the ring
+  }
+
+  return (unsigned char *)&UartRxBuffer[tail];
+}
+
+
+
+/*
+ * Remove len bytes returned by uart_rx_data() from the buffer
+ */
+void uart_rx_consume(uint16_t len)
+{
+  // Wrap before storing, the RX interrupt reads the tail
+  uint16_t tail = UartRxBuffer_tail + len;
+
+  UartRxBuffer_tail = tail >= UART_BUF_LEN ? tail - UART_BUF_LEN : tail;
+
+#if UART_USE_FLOW_CTRL == 1
+  // Disable interrupts to make sure the DMA state isn't modified in the middle
+  __bic_status_register(GIE);
+  uart_rts_update();
+  // Enable interrupts
+  __bis_status_register(GIE);
+#endif
+}
+
+
+
+/*
+ * Called from the main loop. Once the line has stayed idle for a poll
+ * period, stop the DMA so that the next byte wakes up the CPU again.
+ */
+void uart_rx_poll(void)
+{
+#if UART_USE_DMA == 1
+  uint16_t head;
+
+  if (!timer_poll_occurred) {
+    return;
+  }
+
+  // Disable interrupts to make sure the DMA state isn't modified in the middle
+  __bic_status_register(GIE);
+
+  timer_poll_occurred = 0;
+  if (uart_rx_dma_len > 0) {
+    head = uart_rx_head();
+    if (head == uart_rx_idle_head) {
+      DMA0CTL &= ~DMAEN;
+      uart_rx_dma_stop(uart_rx_dma_count());
+    }
+    uart_rx_idle_head = head;
+  }
+
+  // Enable interrupts
+  __bis_status_register(GIE);
+#endif
+}
+
+
+
+/*
+ * Set the baud rate divider and modulation for the current SMCLK, as in
+ * the baud rate calculation of the User's Guide. E.g. at 1MHz 115200
+ * gives UCBRx=9 and UCBRSx=1, and at 20MHz 1000000 gives UCOS16 with
+ * UCBRx=1 and UCBRFx=4.
+ */
+static void uart_set_baud(uint32_t baud)
+{
+  uint32_t smclk = clock_hz();
+  uint16_t br;
+  uint8_t mod;
+
+  if (smclk / baud >= 16) {
+    // Oversampling mode: N / 16 in UCBRx, the fraction in 1/16ths in UCBRFx
+    br = smclk / (16 * baud);
+    mod = (smclk + baud / 2) / baud - 16 * br;
+    if (mod == 16) {
+      ++br;
+      mod = 0;
+    }
+    UCA0BRW = br;
+    UCA0MCTL = UCOS16 + (mod << 4);
+  } else {
+    // Low frequency mode: N in UCBRx, the fraction in 1/8ths in UCBRSx
+    br = smclk / baud;
+    mod = (8 * smclk + baud / 2) / baud - 8 * br;
+    if (mod == 8) {
+      ++br;
+      mod = 0;
+    }
+    UCA0BRW = br;
+    UCA0MCTL = mod << 1;
+  }
+}
+
+
+
 /*
  * Called from interrupt handler to handle the received byte over uart
  */
@@ -176,18 +490,244 @@ static void handle_uart_rx_byte(void)
   tmpchar = UCA0RXBUF;
 
   // Discard the byte if buffer already full
-  if (UartRxBuffer_i == UART_BUF_LEN) {
+  if (uart_rx_free() == 0) {
     return;
   }
 
   // Store received byte
-  UartRxBuffer[UartRxBuffer_i++] = tmpchar;
+  UartRxBuffer[UartRxBuffer_head] = tmpchar;
+  if (++UartRxBuffer_head == UART_BUF_LEN) {
+    UartRxBuffer_head = 0;
+  }
+
+#if UART_USE_FLOW_CTRL == 1
+  uart_rts_update();
+#endif
 
   return;
 }
 
 
 
+/*
+ * Return the write position of the RX ring buffer, including the bytes
+ * the DMA has received. Call with interrupts disabled.
+ */
+static uint16_t uart_rx_head(void)
+{
+#if UART_USE_DMA == 1
+  uint16_t head;
+
+  if (uart_rx_dma_len > 0) {
+    head = UartRxBuffer_head + uart_rx_dma_count();
+    return head >= UART_BUF_LEN ? head - UART_BUF_LEN : head;
+  }
+#endif
+
+  return UartRxBuffer_head;
+}
+
+
+
+/*
+ * Return the free space in the RX ring buffer, one byte is always kept
+ * free to tell a full buffer from an empty one. Call with interrupts
+ * disabled.
+ */
+static uint16_t uart_rx_free(void)
+{
+  uint16_t free = UartRxBuffer_tail + UART_BUF_LEN - uart_rx_head() - 1;
+
+  // No division here, this is on the RX interrupt path
+  return free >= UART_BUF_LEN ? free - UART_BUF_LEN : free;
+}
+
+
+
+#if UART_USE_DMA == 1
+/*
+ * Return the number of bytes the RX DMA has moved in the current block
+ */
+static uint16_t uart_rx_dma_count(void)
+{
+  uint16_t left = DMA0SZ;
+
+  // The size is reloaded when the block is done, check the flag after it
+  if (DMA0CTL & DMAIFG) {
+    return uart_rx_dma_len;
+  }
+
+  return uart_rx_dma_len - left;
+}
+
+
+
+/*
+ * Let the DMA receive the next bytes after the one just handled, up to
+ * the threshold, the end of the ring or the free space. Called from the
+ * RX interrupt handler.
+ */
+static void uart_rx_dma_start(void)
+{
+  uint16_t len = UART_BUF_LEN - UartRxBuffer_head;
+  uint16_t free = uart_rx_free();
+
+  if (len > UART_RX_DMA_THRESHOLD) {
+    len = UART_RX_DMA_THRESHOLD;
+  }
+#if UART_USE_FLOW_CTRL == 1
+  // Stop at the RTS threshold, the bytes after it are taken one by one
+  free = free > UART_RX_STOP_FREE ? free - UART_RX_STOP_FREE : 0;
+#endif
+  if (len > free) {
+    len = free;
+  }
+
+  // Buffer full, keep on discarding the bytes in the interrupt handler
+  if (len == 0) {
+    return;
+  }
+
+  DMA0DA = (uintptr_t)&UartRxBuffer[UartRxBuffer_head];
+  DMA0SZ = len;
+  uart_rx_dma_len = len;
+  uart_rx_idle_head = UartRxBuffer_head;
+  UCA0IE &= ~UCRXIE;                        // The DMA takes the bytes from now on
+  DMA0CTL |= DMAEN;
+
+  // The DMA triggers on the rising edge of RXIFG. A byte received while
+  // the DMA was set up has already raised it, so raise it again.
+  if (UCA0IFG & UCRXIFG) {
+    UCA0IFG &= ~UCRXIFG;
+    UCA0IFG |= UCRXIFG;
+  }
+
+  timer_poll_set(UART_RX_IDLE_MS);
+}
+
+
+
+/*
+ * Stop the RX DMA at a threshold or an idle line after it has received
+ * count bytes, and go back to an interrupt on the next byte. Call with
+ * interrupts disabled.
+ */
+static void uart_rx_dma_stop(uint16_t count)
+{
+  DMA0CTL &= ~(DMAEN + DMAIFG);
+  UartRxBuffer_head += count;
+  if (UartRxBuffer_head >= UART_BUF_LEN) {
+    UartRxBuffer_head -= UART_BUF_LEN;
+  }
+  uart_rx_dma_len = 0;
+
+  timer_poll_clear();
+
+  // A byte received after the DMA was stopped raises the interrupt at once
+  UCA0IE |= UCRXIE;
+
+#if UART_USE_FLOW_CTRL == 1
+  uart_rts_update();
+#endif
+}
+
+
+
+/*
+ * Send the unsent data up to the end of the TX ring with the DMA.
+ * Called from the TX interrupt handler, when TXBUF is empty.
+ */
+static void uart_tx_dma_start(void)
+{
+  uint16_t head = UartTxBuffer_head;
+
+  if (head > UartTxBuffer_tail) {
+    uart_tx_dma_len = head - UartTxBuffer_tail;
+  } else {
+    uart_tx_dma_len = UART_BUF_LEN - UartTxBuffer_tail;
+  }
+
+  DMA1SA = (uintptr_t)&UartTxBuffer[UartTxBuffer_tail];
+  DMA1SZ = uart_tx_dma_len;
+  DMA1CTL |= DMAEN;
+
+  // The DMA triggers on the rising edge of TXIFG, which is already set
+  UCA0IFG &= ~UCTXIFG;
+  UCA0IFG |= UCTXIFG;
+}
+#endif
+
+
+
+#if UART_USE_FLOW_CTRL == 1
+/*
+ * Raise RTS when the RX buffer is about to fill up and lower it when
+ * there's room again. Call with interrupts disabled.
+ */
+static void uart_rts_update(void)
+{
+  uint16_t free = uart_rx_free();
+
+  if (free <= UART_RX_STOP_FREE) {
+    UART_RTS_POUT |= UART_RTS_BIT;
+  } else if (free >= UART_RX_START_FREE) {
+    UART_RTS_POUT &= ~UART_RTS_BIT;
+  }
+}
+
+
+
+/*
+ * Stop sending when CTS goes high and continue when it goes low. The
+ * edge is flipped to catch the next change, and the pin is read again
+ * in case it changed in between.
+ */
+static void uart_cts_changed(void)
+{
+  uint8_t high;
+
+  do {
+    high = (UART_CTS_PIN & UART_CTS_BIT) != 0;
+    if (high) {
+      UART_CTS_PIES |= UART_CTS_BIT;        // Next the falling edge
+    } else {
+      UART_CTS_PIES &= ~UART_CTS_BIT;       // Next the rising edge
+    }
+  } while (high != ((UART_CTS_PIN & UART_CTS_BIT) != 0));
+
+  if (high) {
+#if UART_USE_DMA == 1
+    // Stop the DMA in the middle of the block, unless it just finished
+    if (uart_tx_dma_len > 0 && (DMA1CTL & DMAEN)) {
+      DMA1CTL &= ~DMAEN;
+      if (!(DMA1CTL & DMAIFG)) {
+        UartTxBuffer_tail += uart_tx_dma_len - DMA1SZ;
+        if (UartTxBuffer_tail >= UART_BUF_LEN) {
+          UartTxBuffer_tail -= UART_BUF_LEN;
+        }
+        uart_tx_dma_len = 0;
+        uart_tx_stopped = 1;
+      }
+    }
+#endif
+    // Without the DMA the TX interrupt checks CTS before every byte
+    return;
+  }
+
+  if (!uart_tx_stopped) {
+    return;
+  }
+  uart_tx_stopped = 0;
+
+  UCA0IE |= UCTXIE;
+#if UART_USE_DMA == 0
+  UCA0TXBUF = UartTxBuffer[UartTxBuffer_tail]; // TXBUF is empty while stopped
+#endif
+}
+#endif
+
+
+
 /* Emacs indentatation information
    Local Variables:
    indent-tabs-mode:nil
@@ -35,23 +35,54 @@
 #include <msp430.h>
 #include <stdint.h>
 
-#define UART_BUF_LEN       (PAYLOAD_LEN * 3)   // Bigger buffers for uart
+#define UART_BUF_LEN       (PAYLOAD_LEN * 2)   // Bigger buffers for uart
+#define UART_BAUD          115200UL            // Default baud rate
 
 #define UART_RX_NEWDATA_TIMEOUT_MS       4   // 4ms timeout for sending current uart rx data
 //#define UART_RX_NEWDATA_TIMEOUT_MS       511   // 511ms timeout for sending current uart rx data
 
-// Buffer for incoming data from UART
-extern volatile unsigned char UartRxBuffer[UART_BUF_LEN];
-extern volatile unsigned char UartRxBuffer_i;
+// Move the UART data with the DMA. The CPU wakes up on the first byte
+// of a burst, every UART_RX_DMA_THRESHOLD bytes, on an idle line and
+// when a TX block has been sent, instead of on every byte.
+#ifndef UART_USE_DMA
+#define UART_USE_DMA                     1
+#endif
+
+#define UART_RX_DMA_THRESHOLD  (UART_BUF_LEN / 2)  // Wake up after this many bytes
+#define UART_RX_IDLE_MS                  2   // Line idle for this long ends the burst
+
+// RTS/CTS flow control on two GPIOs, both active low. RTS goes high when
+// the RX buffer has UART_RX_STOP_FREE bytes or less free and low again
+// once UART_RX_START_FREE bytes are free. Nothing is sent while CTS is
+// high. uart.c takes the port 2 interrupt for CTS.
+#ifndef UART_USE_FLOW_CTRL
+#define UART_USE_FLOW_CTRL               0
+#endif
+
+#define UART_RTS_POUT      P1OUT
+#define UART_RTS_PDIR      P1DIR
+#define UART_RTS_BIT       BIT7                // P1.7
+#define UART_CTS_PIN       P2IN
+#define UART_CTS_POUT      P2OUT
+#define UART_CTS_PDIR      P2DIR
+#define UART_CTS_PREN      P2REN
+#define UART_CTS_PIE       P2IE
+#define UART_CTS_PIES      P2IES
+#define UART_CTS_PIFG      P2IFG
+#define UART_CTS_BIT       BIT7                // P2.7
+
+#define UART_RX_STOP_FREE               16   // Room for the bytes the host sends after RTS
+#define UART_RX_START_FREE     (UART_BUF_LEN / 2)
 
-// Buffer for outoing data over UART
-extern volatile unsigned char UartTxBuffer[UART_BUF_LEN];
-extern volatile unsigned char UartTxBuffer_i;
-extern volatile unsigned char UartTxBufferLength;
 extern volatile unsigned char uart_rx_timeout;
 
 
-void uart_init(void);
+void uart_init(uint32_t baud);
+uint16_t uart_rx_pending(void);
+unsigned char *uart_rx_data(uint16_t *len);
+void uart_rx_consume(uint16_t len);
+void uart_rx_poll(void);
+uint16_t uart_tx_free(void);
 uint8_t uart_tx_append_msg(unsigned char *buf, unsigned char len);
 void uart_send_next_msg(void);
 
@@ -27,8 +27,21 @@
  */
 
 #include "utils.h"
+#include "clock.h"
 #include "stdint.h"
 
+// MCLK cycles of one busysleep_rounds() loop round: the delay plus about
+// 4 cycles for the decrement, the test and the jump
+#define BUSYSLEEP_LOOP_CYCLES   8
+
+static void busysleep_calibrate(void);
+static void busysleep_rounds(uint16_t rounds);
+
+// Loop rounds for the current clock, computed once per clock speed
+static uint32_t busysleep_hz = 0;
+static uint16_t busysleep_ms_rounds;        // Per millisecond
+static uint16_t busysleep_us_rounds;        // Per microsecond, 8.8 fixed point
+
 
 
 /*
@@ -92,8 +105,11 @@ unsigned char sc_itoa(int32_t value, unsigned char *str, unsigned char len)
 void busysleep_ms(int ms)
 {
   int a;
+
+  busysleep_calibrate();
+
   for (a = 0; a < ms; a++) {
-    __delay_cycles(1000);
+    busysleep_rounds(busysleep_ms_rounds);
   }
 }
 
@@ -105,9 +121,49 @@ void busysleep_ms(int ms)
  */
 void busysleep_us(int us)
 {
-  int a;
-  for (a = 0; a < us; a++) {
-    __delay_cycles(1);
+  if (us >= 1000) {
+    busysleep_ms(us / 1000);
+    us %= 1000;
+  }
+
+  busysleep_calibrate();
+
+  busysleep_rounds(((uint32_t)us * busysleep_us_rounds + 128) >> 8);
+}
+
+
+
+
+/*
+ * Compute the loop rounds per millisecond and microsecond, when the
+ * clock has changed. Rounded to the nearest round, not truncated to
+ * whole MHz.
+ */
+static void busysleep_calibrate(void)
+{
+  uint32_t hz = clock_hz();
+
+  if (hz == busysleep_hz) {
+    return;
+  }
+
+  busysleep_hz = hz;
+  busysleep_ms_rounds = (hz + 500UL * BUSYSLEEP_LOOP_CYCLES) /
+    (1000UL * BUSYSLEEP_LOOP_CYCLES);
+  // hz x 256 / 1000000 without overflowing 32 bits
+  busysleep_us_rounds = (hz * 16 / BUSYSLEEP_LOOP_CYCLES + 31250) / 62500;
+}
+
+
+
+
+/*
+ * Spend rounds x BUSYSLEEP_LOOP_CYCLES MCLK cycles
+ */
+static void busysleep_rounds(uint16_t rounds)
+{
+  while (rounds-- > 0) {
+    __delay_cycles(BUSYSLEEP_LOOP_CYCLES - 4);
   }
 }
 
@@ -29,9 +29,11 @@
 
 #include "common.h"
 #include "adc.h"
+#include "batch.h"
 #include "i2c.h"
 #include "led.h"
 #include "rf.h"
+#include "telemetry.h"
 #include "timer.h"
 #include "tmp275.h"
 #include "uart.h"
@@ -44,11 +46,24 @@
 #include <stdint.h>
 
 static void send_message(uint16_t batt, uint16_t temp);
+static void send_batch(void);
 
 #define RB_USE_RF                1
+#define RB_USE_ARQ               1
+#define RB_USE_CSMA              1
+#define RB_USE_FEC               0        // Must match the gateway
+#define RB_USE_TX_POWER_CTRL     1
+#define RB_NODE_ADDR             0x10     // Own address for each node
+#define RB_CHANNEL               0
+#define RB_HOP_MODE              RF_HOP_OFF
 #define RB_USE_ADC               1
 #define RB_USE_I2C               1
 #define RB_USE_SHUTDOWN_TMP275   0
+#define RB_BATCH_COUNT           4        // Readings sent in one packet
+#define RB_BATCH_DEADLINE_S      60       // Max time to hold a reading
+#define RB_SLEEP_S               4        // Time between readings
+
+static tlm_stream_t telemetry;
 
 int main(void)
 {
@@ -83,20 +98,23 @@ int main(void)
   __bis_status_register(GIE);
   #endif
 
+  #if RB_USE_RF
+  batch_init(RB_BATCH_COUNT, RB_BATCH_DEADLINE_S);
+  tlm_stream_init(&telemetry);
+  #endif
+
   // Main loop:
   // - init i2c
   // - initiate tmp275 (will take 220ms) in one shot mode
   // - sleep 220
   // - initiate battery adc
-  // - start radio
-  // - wait until radio idle
   // - battery adc ready
   // - shutdown adc
   // - read tmp275
   // - shutdown i2c
-  // - wait for empty air
-  // - send message
-  // - shutdown radio
+  // - add the message to the batch
+  // - if the batch is due, start radio, wait for empty air, send the
+  //   batch and shutdown radio
   // - LPM4
   // - sleep minutes
   while(1) {
@@ -128,14 +146,6 @@ int main(void)
     adc_start(sizeof(channels), channels, ADC12SHT0_6, ADC_MODE_SINGLE);
     #endif
 
-    #if RB_USE_RF
-    rf_init();
-
-    rf_wait_for_idle();
-
-    rf_receive_on();
-    #endif
-
     #if RB_USE_ADC
     if (1) {
       uint8_t adc_timeout = 0;
@@ -173,13 +183,14 @@ int main(void)
     #endif
 
     #if RB_USE_RF
+    rf_fscal_temperature((int16_t)temp >> 8);
     send_message(adcbatt, temp);
-    #endif
 
     led_on(2);
 
-    #if RB_USE_RF
-    rf_shutdown();
+    if (batch_due()) {
+      send_batch();
+    }
     #endif
 
     led_off(1);
@@ -187,7 +198,10 @@ int main(void)
 
     SetVCore(0);
 
-    timer_sleep_ms(4*1000, LPM4_bits);
+    timer_sleep_ms(RB_SLEEP_S*1000, LPM4_bits);
+    #if RB_USE_RF
+    batch_elapsed(RB_SLEEP_S);
+    #endif
 
     //timer_sleep_min(10, LPM4_bits);
   }
@@ -195,82 +209,77 @@ int main(void)
 
 
 /*
- * Construct a message and send it over the RF
+ * Construct a telemetry reading and add it to the batch sent over the RF
  */
 static void send_message(uint16_t adcbatt, uint16_t rawtemp)
 {
-  unsigned char buf[UART_BUF_LEN];
-  unsigned char len = 0;
-  uint8_t rf_timeout = 0;
-
-  // Send battery level
-  buf[len++] = 'B';
-  buf[len++] = ':';
-  buf[len++] = ' ';
-  len += sc_itoa(adcbatt, &buf[len], UART_BUF_LEN - len);
-  buf[len++] = ',';
-  buf[len++] = ' ';
-
-  // Send temperature
-  {
-    int16_t temp;
-    uint16_t temp_int;
-    uint32_t temp_frac;
-    char sign = 1;
-
-    temp = (int16_t)rawtemp;
-
-    /* Grab the sign and convert to positive
-     * Negative integer math is... interesting so we take the risk of
-     * asymmetry and convert to positive. This might incur heavy error
-     * for some values, but is verified to work correctly with a fixed
-     * dataset in the range of 127.93...-55.00 (from datasheets).
-     */
-    if (temp < 0) {
-      sign = -1;
-      temp *= -1;
-    }
-    buf[len++] = 'T';
-    buf[len++] = ':';
-    buf[len++] = ' ';
-
-    /* We always mark the sign to make parsing easier */
-    buf[len++] = (sign == 1) ? '+' : '-';
+  unsigned char buf[TLM_STREAM_HDR_LEN + 2*TLM_REC_MAX];
+  uint8_t len;
+
+  len = tlm_stream_begin(&telemetry, buf);
+  len += tlm_stream_put(&telemetry, TLM_BATTERY, adcbatt, &buf[len]);
+  len += tlm_stream_put(&telemetry, TLM_TEMPERATURE, (int16_t)rawtemp, &buf[len]);
+  len = tlm_end(buf, len);
+
+  // Batch the message, send the earlier ones first if it doesn't fit
+  if (!batch_add(buf, len)) {
+    send_batch();
+    batch_add(buf, len);
+  }
+}
 
-    /* Integer part */
-    temp_int = temp >> 8;
 
-    len += sc_itoa(temp_int, buf + len, UART_BUF_LEN - len);
 
-    /* Decimal part is in the low 8 bits, but only top 4 bits are used.
-     * One step is roughly 0.06253 degrees Celsius, but no floats here!
-     * So we multiply by 6253 and divide by 1000 to catch the first two
-     * decimal places
-     */
-    temp_frac = (((((uint32_t)temp) & 0xf0) >> 4) * 6253) / 1000;
-    buf[len++] = '.';
+/*
+ * Start the radio and send the batched messages in one packet
+ */
+static void send_batch(void)
+{
+  static uint8_t rf_configured = 0;
+  uint16_t rf_timeout = 0;
+  uint8_t lost = rf_tx_lost;
+
+  // Reset and configure the radio on the first round, later just wake
+  // it up with the settings kept over the sleep
+  if (rf_configured) {
+    rf_wake();
+  } else {
+    rf_set_address(RB_NODE_ADDR);
+    rf_fec_enable(RB_USE_FEC);
+    rf_init();
+    rf_arq_enable(RB_USE_ARQ);
+    rf_csma_enable(RB_USE_CSMA);
+    rf_tx_power_control(RB_USE_TX_POWER_CTRL);
+    rf_set_channel(RB_CHANNEL);
+    rf_hop_enable(RB_HOP_MODE);
+    rf_configured = 1;
+  }
 
-    /* Add leading zero, if needed */
-    if (temp_frac < 10) {
-      buf[len++] = '0';
-    }
+  rf_wait_for_idle();
 
-    len += sc_itoa(temp_frac, buf + len, UART_BUF_LEN - len);
-    buf[len++] = '\r';
-    buf[len++] = '\n';
-  }
+  rf_receive_on();
 
   // Send the message
-  rf_append_msg(buf, len);
+  batch_flush();
   rf_send_next_msg(RF_SEND_MSG_FORCE);
 
-  // Wait for completion of the tx, with timeout
-  while (rf_transmitting) {
-    if (rf_timeout++ == 20) {
+  // Wait for a clear channel, completion of the tx and the ACK, with timeout
+  while (rf_transmitting || rf_arq_waiting || rf_backoff) {
+    if (rf_timeout++ == RF_SEND_TIMEOUT_MS) {
       break;
     }
     timer_sleep_ms(1, LPM1_bits);
+
+    // Send again, if the channel was busy or the ACK didn't arrive in time
+    rf_send_next_msg(RF_SEND_MSG_FORCE);
   }
+
+  // Start over from a keyframe, if the readings didn't get through
+  if (!batch_delivered(lost)) {
+    tlm_stream_lost(&telemetry);
+  }
+
+  rf_shutdown();
 }
 
 
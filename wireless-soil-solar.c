@@ -29,10 +29,12 @@
 
 #include "common.h"
 #include "adc.h"
+#include "batch.h"
 #include "comp.h"
 #include "i2c.h"
 #include "led.h"
 #include "rf.h"
+#include "telemetry.h"
 #include "timer.h"
 #include "tmp275.h"
 #include "uart.h"
@@ -68,15 +70,28 @@ typedef enum power_flags_t {
 #define ADC_PINS                 (BIT0 | BIT1 | BIT2 | BIT3)
 
 static void send_message(uint32_t *adc, uint16_t temp);
+static void send_batch(void);
 static void get_adc(uint32_t adcdata[], uint8_t min_ch, uint8_t max_ch);
 
+#define RB_USE_ARQ               1
+#define RB_USE_CSMA              1
+#define RB_USE_FEC               0        // Must match the gateway
+#define RB_USE_TX_POWER_CTRL     1
+#define RB_NODE_ADDR             0x30     // Own address for each node
+#define RB_CHANNEL               0
+#define RB_HOP_MODE              RF_HOP_OFF
 #define RB_USE_I2C               1
 #define RB_USE_SHUTDOWN_TMP275   0
+#define RB_BATCH_COUNT           1        // Readings sent in one packet
+#define RB_BATCH_DEADLINE_S      (60*60)  // Max time to hold a reading
 
 static uint8_t power_state;
+static tlm_stream_t telemetry;
 
 int main(void)
 {
+  uint8_t rf_configured = 0;
+
   // Stop watchdog timer to prevent time out reset
   WDTCTL = WDTPW + WDTHOLD;
 
@@ -105,6 +120,9 @@ int main(void)
   // Enable interrupts
   __bis_status_register(GIE);
   #endif
+
+  batch_init(RB_BATCH_COUNT, RB_BATCH_DEADLINE_S);
+  tlm_stream_init(&telemetry);
   
   #if RB_USE_I2C
   // Shutdown TMP275 to save power
@@ -162,7 +180,21 @@ int main(void)
 
       // Increase PMMCOREV level to 2 for proper radio operation
       SetVCore(2);
-      rf_init();
+      // Reset and configure the radio on the first round, later just wake
+      // it up with the settings kept over the sleep
+      if (rf_configured) {
+        rf_wake();
+      } else {
+        rf_set_address(RB_NODE_ADDR);
+        rf_fec_enable(RB_USE_FEC);
+        rf_init();
+        rf_arq_enable(RB_USE_ARQ);
+        rf_csma_enable(RB_USE_CSMA);
+        rf_tx_power_control(RB_USE_TX_POWER_CTRL);
+        rf_set_channel(RB_CHANNEL);
+        rf_hop_enable(RB_HOP_MODE);
+        rf_configured = 1;
+      }
 
       // gdo2 output configuration,
       // 0x39 == RFCLK/24 (1.083MHz)
@@ -188,7 +220,11 @@ int main(void)
       WriteSingleReg(IOCFG2, 0x29);
 
       rf_wait_for_idle();
+      rf_fscal_temperature((int16_t)temp >> 8);
       send_message(adcdata, temp);
+      if (batch_due()) {
+        send_batch();
+      }
       rf_shutdown();
       SetVCore(0);
 
@@ -223,6 +259,7 @@ int main(void)
       sleep_min = 120;
     }
     timer_sleep_min(sleep_min, LPM4_bits);
+    batch_elapsed(sleep_min * 60);
     #endif
 
   }
@@ -230,99 +267,69 @@ int main(void)
 
 
 /*
- * Construct a message and send it over the RF
+ * Construct a telemetry reading and add it to the batch sent over the RF
  */
 static void send_message(uint32_t *adc, uint16_t rawtemp)
 {
   static uint32_t tx_count = 0;
-  unsigned char buf[UART_BUF_LEN];
-  unsigned char len = 0;
+  unsigned char buf[TLM_STREAM_HDR_LEN + (2 + sizeof(ADC_CHANNELS))*TLM_REC_MAX];
+  uint8_t len;
   uint8_t i;
 
-  // Append tx counter
-  buf[len++] = 'S';
-  buf[len++] = '[';
-  buf[len++] = '0';
-  buf[len++] = ']';
-  buf[len++] = ' ';
-  len += sc_itoa(tx_count, &buf[len], UART_BUF_LEN - len);
-  buf[len++] = ' ';
+  len = tlm_stream_begin(&telemetry, buf);
+  len += tlm_stream_put(&telemetry, TLM_COUNTER, tx_count, &buf[len]);
 
   // Append ADC values
   for (i = 0; i < sizeof(ADC_CHANNELS); ++i) {
-    len += sc_itoa(adc[i], &buf[len], UART_BUF_LEN - len);
-    buf[len++] = ' ';
+    len += tlm_stream_put(&telemetry, TLM_ADC + i, adc[i], &buf[len]);
   }
 
-  // Append temperature
-  {
-    int16_t temp;
-    uint16_t temp_int;
-    uint32_t temp_frac;
-    char sign = 1;
-
-    temp = (int16_t)rawtemp;
-
-    /* Grab the sign and convert to positive
-     * Negative integer math is... interesting so we take the risk of
-     * asymmetry and convert to positive. This might incur heavy error
-     * for some values, but is verified to work correctly with a fixed
-     * dataset in the range of 127.93...-55.00 (from datasheets).
-     */
-    if (temp < 0) {
-      sign = -1;
-      temp *= -1;
-    }
-    /* We always mark the sign to make parsing easier */
-    buf[len++] = (sign == 1) ? '+' : '-';
+  len += tlm_stream_put(&telemetry, TLM_TEMPERATURE, (int16_t)rawtemp, &buf[len]);
+  len = tlm_end(buf, len);
 
-    /* Integer part */
-    temp_int = temp >> 8;
+  // Send the message
+#if 1
+  // Batch the message, send the earlier ones first if it doesn't fit
+  if (!batch_add(buf, len)) {
+    send_batch();
+    batch_add(buf, len);
+  }
+#else
+  uart_tx_append_msg(buf, len);
+  uart_send_next_msg();
+#endif
 
-    len += sc_itoa(temp_int, buf + len, UART_BUF_LEN - len);
+  ++tx_count;
+}
 
-    /* Decimal part is in the low 8 bits, but only top 4 bits are used.
-     * One step is roughly 0.06253 degrees Celsius, but no floats here!
-     * So we multiply by 6253 and divide by 1000 to catch the first two
-     * decimal places
-     */
-    temp_frac = (((((uint32_t)temp) & 0xf0) >> 4) * 6253) / 1000;
-    buf[len++] = '.';
 
-    /* Add leading zero, if needed */
-    if (temp_frac < 10) {
-      buf[len++] = '0';
-    }
 
-    len += sc_itoa(temp_frac, buf + len, UART_BUF_LEN - len);
-  }
+/*
+ * Send the batched messages in one packet. The radio must be awake.
+ */
+static void send_batch(void)
+{
+  uint16_t rf_timeout = 0;
+  uint8_t lost = rf_tx_lost;
 
-  // Append newline
-  buf[len++] = '\r';
-  buf[len++] = '\n';
+  batch_flush();
+  rf_send_next_msg(RF_SEND_MSG_FORCE);
 
-  // Send the message
-#if 1
-  {
-    uint8_t rf_timeout = 0;
+  // Wait for a clear channel, completion of the tx and the ACK, with timeout
+  while (rf_transmitting || rf_arq_waiting || rf_backoff) {
+    if (rf_timeout++ == RF_SEND_TIMEOUT_MS) {
+      break;
+    }
+    timer_sleep_ms(1, LPM1_bits);
 
-    rf_append_msg(buf, len);
+    // Send again, if the channel was busy or the ACK didn't arrive in time
     rf_send_next_msg(RF_SEND_MSG_FORCE);
-
-    // Wait for completion of the tx, with timeout
-    while (rf_transmitting) {
-      if (rf_timeout++ == 200) {
-        break;
-      }
-      busysleep_us(100);
-    }
   }
-#else
-  uart_tx_append_msg(buf, len);
-  uart_send_next_msg();
-#endif
 
-  ++tx_count;
+  // Start over from a keyframe, if the readings didn't get through
+  if (!batch_delivered(lost)) {
+    tlm_stream_lost(&telemetry);
+  }
 }
 
 /*
@@ -28,9 +28,11 @@
 #include "common.h"
 
 #include "adc.h"
+#include "clock.h"
 #include "i2c.h"
 #include "led.h"
 #include "rf.h"
+#include "telemetry.h"
 #include "timer.h"
 #include "tmp275.h"
 #include "uart.h"
@@ -43,18 +45,213 @@
 #include <stdint.h>
 
 #define UART_RX_NEWDATA_TIMEOUT_MS       4   // 4ms timeout for sending current uart rx data
+#define LINK_INFO_LEN                   12   // Space needed for " RSSI LQI\r\n"
+
+// RF messages sent before waiting for an ACK. 0 disables ACKs, 1 is
+// stop-and-wait, larger windows keep the link busy during bulk transfers.
+#ifndef RB_ARQ_WINDOW
+#define RB_ARQ_WINDOW                    RF_ARQ_MAX_WINDOW
+#endif
+
+#ifndef RB_USE_CSMA
+#define RB_USE_CSMA                      1   // Listen before talk
+#endif
+
+// Forward error correction with fixed length packets, for marginal
+// links. All nodes must use it.
+#ifndef RB_USE_FEC
+#define RB_USE_FEC                       0
+#endif
+
+// MCLK and SMCLK speed, see clock.h, and the UART baud rate. Up to about
+// 1Mbaud works at 20MHz.
+#ifndef RB_CLOCK
+#define RB_CLOCK                         CLOCK_1MHZ
+#endif
+
+#ifndef RB_UART_BAUD
+#define RB_UART_BAUD                     UART_BAUD
+#endif
+
+// Listen in Wake on Radio mode and sleep in LPM3, for a battery powered
+// receiver. The other end must then use a long preamble.
+#ifndef RB_USE_WOR
+#define RB_USE_WOR                       0
+#endif
+
+#ifndef RB_USE_TX_POWER_CTRL
+#define RB_USE_TX_POWER_CTRL             1   // TX power by the RSSI in the ACKs
+#endif
+
+// Address of this node and of the other end of the link
+#ifndef RB_NODE_ADDR
+#define RB_NODE_ADDR                     RF_ADDR_GATEWAY
+#endif
+#ifndef RB_PEER_ADDR
+#define RB_PEER_ADDR                     RF_ADDR_GATEWAY
+#endif
+
+#ifndef RB_CHANNEL
+#define RB_CHANNEL                       0
+#endif
+
+// Frequency hopping. The gateway is usually the master.
+#ifndef RB_HOP_MODE
+#define RB_HOP_MODE                      RF_HOP_OFF
+#endif
+
+#ifndef RB_USE_LONG_PREAMBLE
+#define RB_USE_LONG_PREAMBLE             0   // Send to a receiver in WOR mode
+#endif
+
+// Adapt the data rate to the link. Both ends of a point to point link
+// must use it.
+#ifndef RB_USE_RATE_ADAPT
+#define RB_USE_RATE_ADAPT                0
+#endif
+
+// How the RSSI and LQI of received packets are passed to UART
+#define LINK_INFO_NONE                   0   // Payload only
+#define LINK_INFO_TEXT                   1   // " RSSI LQI\r\n" in decimal at the end of the line
+#define LINK_INFO_BINARY                 2   // Raw RSSI and CRC/LQI bytes after the payload
+
+#ifndef LINK_INFO_MODE
+#define LINK_INFO_MODE                   LINK_INFO_TEXT
+#endif
+
+// UART framing. In the SLIP mode (RFC 1055) each frame from the host
+// goes out as one radio packet, and each radio packet comes out as one
+// frame, for binary host protocols. Both ends must use the same framing.
+#define FRAMING_LINES                    0   // Text lines, see rf_send_next_msg()
+#define FRAMING_SLIP                     1   // SLIP frames, any bytes
+
+#ifndef RB_FRAMING
+#define RB_FRAMING                       FRAMING_LINES
+#endif
+
+// SLIP special characters
+#define SLIP_END                      0xC0
+#define SLIP_ESC                      0xDB
+#define SLIP_ESC_END                  0xDC
+#define SLIP_ESC_ESC                  0xDD
+#define SLIP_CHUNK_LEN                  32   // Encoded bytes appended to UART at a time
+#if LINK_INFO_MODE == LINK_INFO_BINARY
+#define SLIP_INFO_LEN                    2   // RSSI and CRC/LQI bytes at the end of a frame
+#else
+#define SLIP_INFO_LEN                    0
+#endif
+
+// Pass binary telemetry readings from the sensor nodes to UART as text
+// lines, "<source address> C:12 B:2345 T:+23.50"
+#ifndef RB_TELEMETRY_DECODE
+#define RB_TELEMETRY_DECODE              1
+#endif
+#define RB_TELEMETRY_PEERS               8   // Nodes with delta encoded streams
+
+// Relay the packets of the nodes out of the gateway's reach. Packets from
+// other nodes than RB_RELAY_NEXT_HOP are sent on to it, with the original
+// sender and a hop count in front. Packets from the next hop are passed
+// to UART as usual.
+#ifndef RB_RELAY
+#define RB_RELAY                         0
+#endif
+#ifndef RB_RELAY_NEXT_HOP
+#define RB_RELAY_NEXT_HOP                RF_ADDR_GATEWAY
+#endif
+#define RB_RELAY_MAX_HOPS                4   // Relays a packet may pass
+#define RB_RELAY_SEEN                    8   // Packets remembered to drop duplicates
+
+// Relay header, at the start of the payload of a packet with RF_FLAG_RELAY
+#define RELAY_ORIGIN                     0   // Node the packet came from
+#define RELAY_HOPS                       1   // Relays passed
+#define RELAY_SEQ                        2   // Link sequence number from the origin
+#define RELAY_HDR_LEN                    3
+
+#if RB_RELAY == 1 && RF_PAYLOAD_RESERVE < RELAY_HDR_LEN
+#error "Build all nodes with RF_PAYLOAD_RESERVE=3 (RELAY_HDR_LEN) to relay"
+#endif
+
+static uint8_t forward_rf_packet(void);
+static void forward_line(unsigned char *buf, uint8_t len, uint8_t rssi_raw, uint8_t lqi);
+#if RB_FRAMING == FRAMING_LINES
+static uint8_t forward_text(unsigned char *buf, uint8_t len, uint8_t rssi_raw, uint8_t lqi);
+#endif
+#if RB_FRAMING == FRAMING_LINES && RB_TELEMETRY_DECODE == 1
+static uint8_t forward_readings(uint8_t src, unsigned char *data, uint8_t len,
+                                uint8_t rssi_raw, uint8_t lqi);
+#endif
+#if RB_FRAMING == FRAMING_SLIP
+static uint8_t slip_receive(void);
+static uint8_t forward_frame(unsigned char *buf, uint8_t len, uint8_t rssi_raw, uint8_t lqi);
+static void slip_put(unsigned char c);
+static void slip_flush(void);
+
+// Frame being decoded from UART
+static unsigned char slip_frame[PAYLOAD_LEN];
+static uint8_t slip_len = 0;
+static uint8_t slip_esc = 0;                  // Previous byte was SLIP_ESC
+static uint8_t slip_overflow = 0;             // Frame too long, drop it
+
+// Frame being encoded to UART
+static unsigned char slip_out[SLIP_CHUNK_LEN];
+static uint8_t slip_out_len = 0;
+#endif
+
+// Packet being passed to UART, left in the RF RX queue until it's all out
+static uint8_t forward_busy = 0;              // Partly passed on, already checked
+static uint16_t forward_pos = 0;              // Next reading or SLIP item
+
+#if RB_RELAY == 1
+static uint8_t seen_packet(uint8_t origin, uint8_t seq);
+static uint8_t relay_pending(void);
+static uint8_t relay_rf_packet(void);
+
+// Latest relayed packets, by origin and sequence number. A packet can
+// arrive through two relays, e.g. a broadcast heard by both.
+static uint8_t seen_origin[RB_RELAY_SEEN];
+static uint8_t seen_seq[RB_RELAY_SEEN];
+static uint8_t seen_count = 0;
+static uint8_t seen_next = 0;
+
+// Relayed packets wait in the RF RX queue for their turn in the TX queue
+static uint8_t relay_turn = 0;                // Relayed packet goes before UART data
+#endif
+
+#if RB_TELEMETRY_DECODE == 1
+static tlm_stream_t *telemetry_stream(uint8_t src);
+
+// Decoder state of the telemetry streams of the latest nodes heard
+static uint8_t tlm_peer_addr[RB_TELEMETRY_PEERS];
+static tlm_stream_t tlm_peer_stream[RB_TELEMETRY_PEERS];
+static uint8_t tlm_peer_next = 0;
+#endif
 
 int main(void)
 {
+#if RB_FRAMING == FRAMING_LINES
+  unsigned char *uart_data;
+  uint16_t uart_len;
+#endif
+
   // Stop watchdog timer to prevent time out reset
   WDTCTL = WDTPW + WDTHOLD;
 
   // Increase PMMCOREV level to 2 for proper radio operation
   SetVCore(2);
+  clock_init(RB_CLOCK);
 
+  rf_set_address(RB_NODE_ADDR);
+  rf_fec_enable(RB_USE_FEC);
   rf_init();
+  rf_arq_enable(RB_ARQ_WINDOW);
+  rf_csma_enable(RB_USE_CSMA);
+  rf_long_preamble(RB_USE_LONG_PREAMBLE);
+  rf_rate_adapt_enable(RB_USE_RATE_ADAPT);
+  rf_tx_power_control(RB_USE_TX_POWER_CTRL);
+  rf_set_channel(RB_CHANNEL);
+  rf_hop_enable(RB_HOP_MODE);
 
-  uart_init();
+  uart_init(RB_UART_BAUD);
   led_init();
 
 #if SC_USE_SLEEP == 0
@@ -73,6 +270,8 @@ int main(void)
       // Reset radio on error
       if (rf_error) {
         rf_init();
+        forward_busy = 0;
+        forward_pos = 0;
       }
 
       // Wait until idle
@@ -81,30 +280,95 @@ int main(void)
       }
 
       // Start listening
+#if RB_USE_WOR == 1
+      rf_receive_wor();
+#else
       rf_receive_on();
+#endif
     }
 
 #if SC_USE_SLEEP == 1
     // Sleep while waiting for interrupt
+#if RB_USE_WOR == 1
+    __bis_status_register(LPM3_bits + GIE);
+#else
     __bis_status_register(LPM0_bits + GIE);
+#endif
 #else
     busysleep_ms(1);
 #endif
 
-    // If there is data received from UART, push it to RF.
-    if (UartRxBuffer_i > 0) {
-      rf_append_msg((unsigned char *)UartRxBuffer, UartRxBuffer_i);
-      UartRxBuffer_i = 0;
+    // Change the data rate agreed with the other end, or fall back to the
+    // slowest one if the link has gone quiet
+    rf_poll();
+
+    // Move to the next channel when it's time to
+    rf_hop_poll();
+
+    // End the UART RX burst once the line goes idle
+    uart_rx_poll();
+
+    // Pass packets received over RF to UART, while there's space for them.
+    // The rest wait in the RX queue, so a host holding CTS doesn't stall
+    // the loop.
+    while (rf_receive_pending() > 0) {
+#if RB_RELAY == 1
+      // Relay the packets from the nodes further away. Until the TX queue
+      // takes them they stay in the RX queue, and once that is full the
+      // radio stops acknowledging new ones.
+      if (relay_pending()) {
+        if (!relay_rf_packet()) {
+          break;
+        }
+        continue;
+      }
+#endif
+      if (!forward_rf_packet()) {
+        break;
+      }
+    }
+
+#if RB_FRAMING == FRAMING_SLIP
+    // Queue the complete frames received from UART, one packet each
+#if RB_RELAY == 1
+    // Relayed packets and UART data take turns in the RF TX queue
+    if ((!relay_turn || !relay_pending()) && slip_receive() > 0) {
+      relay_turn = 1;
+    }
+#else
+    slip_receive();
+#endif
+#else
+    // If there is data received from UART, push it to RF. Queue as much
+    // as fits, up to a packet at a time, and leave the rest in the UART
+    // buffer, so it doesn't wait for the RF queue to drain completely.
+    uart_data = uart_rx_data(&uart_len);
+    if (uart_len > RF_QUEUE_LEN - RfTxQueueLength) {
+      uart_len = RF_QUEUE_LEN - RfTxQueueLength;
+    }
+    if (uart_len > rf_max_payload()) {
+      uart_len = rf_max_payload();
+    }
+#if RB_RELAY == 1
+    // Relayed packets and UART data take turns in the RF TX queue
+    if (uart_len > 0 && (!relay_turn || !relay_pending()) &&
+        rf_append_msg_to(RB_PEER_ADDR, uart_data, uart_len)) {
+      relay_turn = 1;
+#else
+    if (uart_len > 0 && rf_append_msg_to(RB_PEER_ADDR, uart_data, uart_len)) {
+#endif
+      uart_rx_consume(uart_len);
       timer_set(UART_RX_NEWDATA_TIMEOUT_MS);
     }
+#endif
 
     // We have data to send over RF
-    if (RfTxQueue_i > 0) {
+    if (RfTxQueueLength > 0) {
       uint8_t len;
       enum RF_SEND_MSG mode = RF_SEND_MSG_FULL;
       
       // On UART RX timeout or with full buffer, send msg even without \n
-      if (timer_occurred || RfTxQueue_i == RF_QUEUE_LEN) {
+      if (timer_occurred || RfTxQueueLength == RF_QUEUE_LEN) {
         mode = RF_SEND_MSG_FORCE;
       }
 
@@ -119,6 +383,473 @@ int main(void)
 }
 
 
+
+/*
+ * Pass the oldest packet received over RF to UART. Formatting the link
+ * information is done here in the main loop, not in the radio interrupt.
+ * Returns 0 if the UART has no room for (the rest of) the packet. It
+ * then stays in the RF RX queue, so that a host holding CTS high doesn't
+ * stall the main loop.
+ */
+static uint8_t forward_rf_packet(void)
+{
+  unsigned char buf[PAYLOAD_LEN];
+  unsigned char *data = buf;
+  uint8_t len;
+  uint8_t rssi_raw;
+  uint8_t lqi;
+  uint8_t relayed;
+  uint8_t done;
+
+  relayed = rf_receive_relayed();
+
+  len = rf_receive_peek(buf, &rssi_raw, &lqi);
+
+  // Relayed packet, the origin is in the relay header
+  if (relayed) {
+    if (len < RELAY_HDR_LEN) {
+      rf_receive_release();
+      return 1;
+    }
+#if RB_RELAY == 1
+    // A copy can arrive through another relay. Check once, not again
+    // when resuming the packet. The link layer already drops the
+    // retransmissions of direct packets.
+    if (!forward_busy && seen_packet(buf[RELAY_ORIGIN], buf[RELAY_SEQ])) {
+      rf_receive_release();
+      return 1;
+    }
+#endif
+    data = &buf[RELAY_HDR_LEN];
+    len -= RELAY_HDR_LEN;
+  }
+  forward_busy = 1;
+
+#if RB_FRAMING == FRAMING_SLIP
+  done = forward_frame(data, len, rssi_raw, lqi);
+#elif RB_TELEMETRY_DECODE == 1
+  if (tlm_reading_len(data, len) > 0) {
+    done = forward_readings(relayed ? buf[RELAY_ORIGIN] : rf_receive_source(),
+                            data, len, rssi_raw, lqi);
+  } else {
+    done = forward_text(data, len, rssi_raw, lqi);
+  }
+#else
+  done = forward_text(data, len, rssi_raw, lqi);
+#endif
+
+  uart_send_next_msg();
+
+  if (done) {
+    forward_busy = 0;
+    forward_pos = 0;
+    rf_receive_release();
+  }
+
+  return done;
+}
+
+
+
+#if RB_FRAMING == FRAMING_LINES
+/*
+ * Pass a packet to UART as one line, once there's room for all of it
+ */
+static uint8_t forward_text(unsigned char *buf, uint8_t len, uint8_t rssi_raw, uint8_t lqi)
+{
+  if (uart_tx_free() <= len + LINK_INFO_LEN) {
+    return 0;
+  }
+
+  forward_line(buf, len, rssi_raw, lqi);
+
+  return 1;
+}
+#endif
+
+
+
+#if RB_FRAMING == FRAMING_LINES && RB_TELEMETRY_DECODE == 1
+/*
+ * Pass the telemetry readings of a packet to UART as text lines, one per
+ * reading, starting from the reading at forward_pos. The text is longer
+ * than the packet, so each line waits for room for the longest one.
+ * Returns 1 once all the lines are out.
+ */
+static uint8_t forward_readings(uint8_t src, unsigned char *data, uint8_t len,
+                                uint8_t rssi_raw, uint8_t lqi)
+{
+  uint8_t reading_len;
+
+  while ((reading_len = tlm_reading_len(&data[forward_pos], len - forward_pos)) > 0) {
+    unsigned char line[TLM_LINE_LEN];
+    uint8_t line_len;
+    uint8_t n;
+
+    if (uart_tx_free() <= TLM_LINE_LEN + LINK_INFO_LEN) {
+      return 0;
+    }
+
+    line_len = sc_itoa(src, line, TLM_LINE_LEN);
+    line[line_len++] = ' ';
+    n = tlm_decode(telemetry_stream(src), &data[forward_pos], &line[line_len],
+                   TLM_LINE_LEN - line_len - 2);
+    if (n == 0) {
+      line[line_len++] = '?';
+    }
+    line_len += n;
+    line[line_len++] = '\r';
+    line[line_len++] = '\n';
+
+    forward_line(line, line_len, rssi_raw, lqi);
+    forward_pos += reading_len;
+  }
+
+  return 1;
+}
+#endif
+
+
+
+/*
+ * Pass a line of payload to UART with the link info
+ */
+static void forward_line(unsigned char *buf, uint8_t len, uint8_t rssi_raw, uint8_t lqi)
+{
+#if LINK_INFO_MODE == LINK_INFO_TEXT
+  // Write RSSI and LQI to the end of the line, remove \r\n
+  if (len >= 2 && buf[len - 2] == '\r' && buf[len - 1] == '\n') {
+    len -= 2;
+  }
+#endif
+
+  uart_tx_append_msg(buf, len);
+
+#if LINK_INFO_MODE == LINK_INFO_TEXT
+  {
+    unsigned char info[LINK_INFO_LEN];
+    unsigned char info_len = 0;
+    unsigned char value_len;
+    int16_t rssi;
+
+    // Convert RSSI to 0-255, 255 being the best signal
+    if (rssi_raw >= 128) {
+      rssi = rssi_raw - 256;
+    } else {
+      rssi = rssi_raw;
+    }
+    rssi -= 2*74; // double RSSI offset from data sheet
+
+    // turn negative value to 0-255, 255 being the best signal
+    rssi += 276;
+
+    info[info_len++] = ' ';
+    value_len = sc_itoa(rssi, &info[info_len], LINK_INFO_LEN - info_len);
+    if (value_len == 0) {
+      info[info_len] = 'X';
+      ++value_len;
+    }
+    info_len += value_len;
+    info[info_len++] = ' ';
+
+    value_len = sc_itoa(lqi, &info[info_len], LINK_INFO_LEN - info_len);
+    if (value_len == 0) {
+      info[info_len] = 'X';
+      ++value_len;
+    }
+    info_len += value_len;
+    info[info_len++] = '\r';
+    info[info_len++] = '\n';
+
+    uart_tx_append_msg(info, info_len);
+  }
+#elif LINK_INFO_MODE == LINK_INFO_BINARY
+  {
+    unsigned char info[2];
+
+    // Status bytes as appended by the radio
+    info[0] = rssi_raw;
+    info[1] = lqi;
+
+    uart_tx_append_msg(info, sizeof(info));
+  }
+#endif
+}
+
+
+
+#if RB_FRAMING == FRAMING_SLIP
+/*
+ * Decode SLIP from the UART RX buffer and queue each complete frame as
+ * one packet. A frame stays in the decoder until the RF TX queue has
+ * room for it. Returns the number of frames queued.
+ */
+static uint8_t slip_receive(void)
+{
+  unsigned char *data;
+  uint16_t len;
+  uint16_t i;
+  uint8_t frames = 0;
+
+  while ((data = uart_rx_data(&len)) != 0 && len > 0) {
+    for (i = 0; i < len; ++i) {
+      unsigned char c = data[i];
+
+      if (c == SLIP_END) {
+        if (slip_len > 0 && !slip_overflow) {
+          if (!rf_append_packet_to(RB_PEER_ADDR, slip_frame, slip_len)) {
+            // No room, try again from this END
+            uart_rx_consume(i);
+            return frames;
+          }
+          ++frames;
+        }
+        slip_len = 0;
+        slip_esc = 0;
+        slip_overflow = 0;
+        continue;
+      }
+
+      if (c == SLIP_ESC) {
+        slip_esc = 1;
+        continue;
+      }
+
+      if (slip_esc) {
+        slip_esc = 0;
+        if (c == SLIP_ESC_END) {
+          c = SLIP_END;
+        } else if (c == SLIP_ESC_ESC) {
+          c = SLIP_ESC;
+        }
+      }
+
+      if (slip_len < rf_max_payload()) {
+        slip_frame[slip_len++] = c;
+      } else {
+        slip_overflow = 1;
+      }
+    }
+    uart_rx_consume(len);
+  }
+
+  return frames;
+}
+
+
+
+/*
+ * Pass a packet to UART as one SLIP frame. In the LINK_INFO_BINARY mode
+ * the raw RSSI and CRC/LQI bytes are at the end of the frame. The
+ * escapes can make a frame longer than the UART buffer, so the frame
+ * goes out in parts as the UART drains, from the item at forward_pos:
+ * the leading END, the payload and link info bytes, the closing END.
+ * Returns 1 once the whole frame is out.
+ */
+static uint8_t forward_frame(unsigned char *buf, uint8_t len, uint8_t rssi_raw, uint8_t lqi)
+{
+  uint16_t room = uart_tx_free();
+  uint16_t last = len + SLIP_INFO_LEN + 1;
+
+  while (forward_pos <= last) {
+    unsigned char c;
+    uint8_t need;
+
+    if (forward_pos == 0 || forward_pos == last) {
+      // Leading END flushes any noise the host has received before the frame
+      if (room < 1) {
+        break;
+      }
+      if (slip_out_len == SLIP_CHUNK_LEN) {
+        slip_flush();
+      }
+      slip_out[slip_out_len++] = SLIP_END;
+      --room;
+      ++forward_pos;
+      continue;
+    }
+
+#if LINK_INFO_MODE == LINK_INFO_BINARY
+    if (forward_pos == len + 1) {
+      c = rssi_raw;
+    } else if (forward_pos == len + 2) {
+      c = lqi;
+    } else
+#endif
+    {
+      c = buf[forward_pos - 1];
+    }
+
+    need = (c == SLIP_END || c == SLIP_ESC) ? 2 : 1;
+    if (room < need) {
+      break;
+    }
+    slip_put(c);
+    room -= need;
+    ++forward_pos;
+  }
+
+  slip_flush();
+
+  return forward_pos > last;
+}
+
+
+
+/*
+ * Add a byte to the encoded frame, escaped if needed
+ */
+static void slip_put(unsigned char c)
+{
+  if (slip_out_len > SLIP_CHUNK_LEN - 2) {
+    slip_flush();
+  }
+
+  if (c == SLIP_END) {
+    slip_out[slip_out_len++] = SLIP_ESC;
+    slip_out[slip_out_len++] = SLIP_ESC_END;
+  } else if (c == SLIP_ESC) {
+    slip_out[slip_out_len++] = SLIP_ESC;
+    slip_out[slip_out_len++] = SLIP_ESC_ESC;
+  } else {
+    slip_out[slip_out_len++] = c;
+  }
+}
+
+
+
+/*
+ * Append the encoded bytes to UART. forward_frame() has checked the
+ * room for them.
+ */
+static void slip_flush(void)
+{
+  if (slip_out_len > 0) {
+    uart_tx_append_msg(slip_out, slip_out_len);
+  }
+  slip_out_len = 0;
+}
+#endif
+
+
+
+#if RB_RELAY == 1
+/*
+ * Return 1 if the packet from origin with the sequence number seq has
+ * already been received, otherwise remember it
+ */
+static uint8_t seen_packet(uint8_t origin, uint8_t seq)
+{
+  uint8_t i;
+
+  for (i = 0; i < seen_count; ++i) {
+    if (seen_origin[i] == origin && seen_seq[i] == seq) {
+      return 1;
+    }
+  }
+
+  seen_origin[seen_next] = origin;
+  seen_seq[seen_next] = seq;
+  seen_next = (seen_next + 1) % RB_RELAY_SEEN;
+  if (seen_count < RB_RELAY_SEEN) {
+    ++seen_count;
+  }
+
+  return 0;
+}
+
+
+
+/*
+ * Check if the oldest received packet is one to relay
+ */
+static uint8_t relay_pending(void)
+{
+  return rf_receive_pending() > 0 && rf_receive_source() != RB_RELAY_NEXT_HOP;
+}
+
+
+
+/*
+ * Move the oldest received packet to the RF TX queue with the relay
+ * header in front, when the queue is empty and it's the relay's turn or
+ * there's no UART data waiting. Returns 0 if the packet has to wait.
+ */
+static uint8_t relay_rf_packet(void)
+{
+  unsigned char buf[RELAY_HDR_LEN + PAYLOAD_LEN];
+  uint8_t src;
+  uint8_t seq;
+  uint8_t relayed;
+  uint8_t len;
+  uint8_t rssi_raw;
+  uint8_t lqi;
+
+  if (RfTxQueueLength > 0 || (!relay_turn && uart_rx_pending() > 0)) {
+    return 0;
+  }
+
+  src = rf_receive_source();
+  seq = rf_receive_seq();
+  relayed = rf_receive_relayed();
+
+  if (relayed) {
+    // Relayed before, count the hop
+    len = rf_receive_packet(buf, &rssi_raw, &lqi);
+    if (len < RELAY_HDR_LEN) {
+      return 1;
+    }
+    ++buf[RELAY_HOPS];
+  } else {
+    len = RELAY_HDR_LEN + rf_receive_packet(&buf[RELAY_HDR_LEN], &rssi_raw, &lqi);
+    buf[RELAY_ORIGIN] = src;
+    buf[RELAY_HOPS] = 1;
+    buf[RELAY_SEQ] = seq;
+  }
+
+  // Drop packets going around in circles, copies of relayed ones, and
+  // ones from a node that didn't keep space for the relay header
+  if (buf[RELAY_HOPS] > RB_RELAY_MAX_HOPS ||
+      (relayed && seen_packet(buf[RELAY_ORIGIN], buf[RELAY_SEQ])) ||
+      len > rf_max_payload() + RF_PAYLOAD_RESERVE) {
+    return 1;
+  }
+
+  if (rf_relay_msg_to(RB_RELAY_NEXT_HOP, buf, len)) {
+    relay_turn = 0;
+  }
+
+  return 1;
+}
+#endif
+
+
+
+#if RB_TELEMETRY_DECODE == 1
+/*
+ * Decoder state of the telemetry stream from src. A node not heard of
+ * before replaces the oldest one and starts from its next keyframe.
+ */
+static tlm_stream_t *telemetry_stream(uint8_t src)
+{
+  uint8_t i;
+
+  for (i = 0; i < RB_TELEMETRY_PEERS; ++i) {
+    if (tlm_peer_addr[i] == src) {
+      return &tlm_peer_stream[i];
+    }
+  }
+
+  i = tlm_peer_next;
+  tlm_peer_next = (i + 1) % RB_TELEMETRY_PEERS;
+  tlm_peer_addr[i] = src;
+  tlm_stream_init(&tlm_peer_stream[i]);
+
+  return &tlm_peer_stream[i];
+}
+#endif
+
+
 /* Emacs indentatation information
    Local Variables:
    indent-tabs-mode:nil